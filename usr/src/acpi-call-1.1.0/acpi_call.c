@@ -2,259 +2,1600 @@
 
 #include <linux/module.h>
 #include <linux/kernel.h>
+#include <linux/ctype.h>
 #include <linux/version.h>
 #include <linux/proc_fs.h>
 #include <linux/slab.h>
 #include <linux/acpi.h>
 #include <linux/uaccess.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/miscdevice.h>
+#include <linux/compat.h>
+#include <linux/list.h>
+#include <linux/poll.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+
+#include "acpi_call.h"
+
+#define CREATE_TRACE_POINTS
+#include "acpi_call_trace.h"
 
 MODULE_LICENSE("GPL");
 
-/* Uncomment the following line to enable debug messages */
-/*
-#define DEBUG
-*/
+/* Uncomment the following line to enable debug messages */
+/*
+#define DEBUG
+*/
+
+#define BUFFER_SIZE 256
+#define MAX_ACPI_ARGS 16
+
+// batches: one call per line, results as "[index] result" lines
+#define BATCH_INPUT_SIZE 4096
+#define MAX_BATCH_CALLS 32
+
+// results grow as needed up to RESULT_MAX, packages nested deeper than
+// MAX_RESULT_DEPTH are shown as [...]
+#define RESULT_MAX (256 * 1024)
+#define MAX_RESULT_DEPTH 16
+
+// ends a result that was cut off, room for it is kept with every reservation
+#define RESULT_TRUNCATED "..."
+
+// asynchronous calls: outstanding calls per file, bytes returned per read
+#define MAX_ASYNC_CALLS 16
+#define ASYNC_READ_MAX (64 * 1024)
+
+// latency histograms: paths beyond LATENCY_PATHS are counted as "other", bucket n
+// counts calls of [2^(n-1), 2^n) us and the last bucket everything above
+#define LATENCY_PATHS 32
+#define LATENCY_PATH_LEN 64
+#define LATENCY_BUCKETS 20
+
+// resolved method handles, never more than HANDLE_CACHE_MAX of them
+#define HANDLE_CACHE_BITS 6
+#define HANDLE_CACHE_MAX 128
+
+// cached call results, never more than RESULT_CACHE_MAX of them
+#define RESULT_CACHE_BITS 6
+#define RESULT_CACHE_MAX 128
+#define CACHE_METHODS_MAX 16
+#define CACHE_METHOD_LEN 64
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 10, 0)
+#define HAVE_PROC_CREATE
+#endif
+
+extern struct proc_dir_entry *acpi_root_dir;
+
+/** Growable result text that tracks its own length. Text beyond RESULT_MAX, or
+text memory ran out for, is dropped and the result ends with RESULT_TRUNCATED
+*/
+struct result_buffer {
+    char *data;
+    size_t len;
+    size_t size;
+    bool truncated;
+};
+
+/** Call state of an open file. Calls through different files run concurrently,
+ACPICA serializes the AML interpreter itself. Calls through the same file are
+serialized by lock
+*/
+struct call_context {
+    struct mutex lock;
+    bool called;
+    bool batch;
+    bool drained;   // the result was read to the end
+    struct result_buffer result;
+    struct result_buffer batch_result;
+
+    // asynchronous calls of the file, in submission order
+    spinlock_t async_lock;
+    struct list_head async_calls;
+    wait_queue_head_t async_wait;
+    u32 async_next_id;
+    unsigned int async_count;
+};
+
+/** A call queued by a write to a file opened with O_NONBLOCK
+*/
+struct async_call {
+    struct list_head node;
+    struct work_struct work;
+    struct call_context *owner;
+    u32 id;
+    bool done;
+    char *input;
+    char *result;   // the whole "id result" line
+    size_t len;
+    size_t pos;     // bytes of the line already read
+};
+
+// result of the latest call through any file, read by files that did not call
+// anything themselves (e.g. echo ... > /proc/acpi/call; cat /proc/acpi/call)
+static struct result_buffer last_result;
+static DEFINE_MUTEX(last_result_lock);
+
+#ifndef HAVE_PROC_CREATE
+// old kernels give the read callback no file, every call goes through this context
+static struct call_context legacy_context;
+#endif
+
+struct latency_hist {
+    char path[LATENCY_PATH_LEN];
+    u64 calls;
+    u64 errors;
+    u64 total_ns;
+    u64 max_ns;
+    u64 buckets[LATENCY_BUCKETS];
+};
+
+static struct latency_hist latency_hists[LATENCY_PATHS];
+static struct latency_hist latency_other = { .path = "other" };
+static int latency_count;
+static DEFINE_MUTEX(latency_lock);
+
+static struct dentry *debugfs_dir;
+
+struct handle_entry {
+    struct hlist_node node;
+    u32 hash;
+    acpi_handle handle;
+    char path[];
+};
+
+static DEFINE_HASHTABLE(handle_cache, HANDLE_CACHE_BITS);
+static DEFINE_MUTEX(handle_cache_lock);
+static int handle_cache_count;
+static u64 handle_cache_hits;
+static u64 handle_cache_misses;
+static u64 handle_cache_flushes;
+
+// flushes both caches on table loads and unloads, only when the ACPI core leaves it to us
+static bool handle_cache_table_handler;
+
+static void flush_result_cache(void);
+
+/** Drops every cached handle, the namespace nodes may be gone
+*/
+static void flush_handle_cache(void)
+{
+    struct handle_entry *entry;
+    struct hlist_node *tmp;
+    int bkt;
+
+    mutex_lock(&handle_cache_lock);
+    hash_for_each_safe(handle_cache, bkt, tmp, entry, node) {
+        hash_del(&entry->node);
+        kfree(entry);
+    }
+    handle_cache_count = 0;
+    handle_cache_flushes++;
+    mutex_unlock(&handle_cache_lock);
+}
+
+static bool handle_cache;
+
+static bool handle_cache_enabled(void)
+{
+    return READ_ONCE(handle_cache);
+}
+
+static int handle_cache_set(const char *val, const struct kernel_param *kp)
+{
+    int ret = param_set_bool(val, kp);
+
+    // entries kept while disabled may have gone stale in the meantime
+    if (!ret)
+        flush_handle_cache();
+
+    return ret;
+}
+
+static const struct kernel_param_ops handle_cache_ops = {
+    .set = handle_cache_set,
+    .get = param_get_bool,
+};
+module_param_cb(handle_cache, &handle_cache_ops, &handle_cache, 0644);
+MODULE_PARM_DESC(handle_cache, "Reuse resolved method handles. A handle goes stale when its table is unloaded at runtime, only enable this if no SSDT is loaded or unloaded while the module is in use, writing the parameter flushes the cache (default: N)");
+
+/** Resolves a fully qualified method path, from the cache if possible
+@param method   The full name of the ACPI method
+@param handle   Set to the handle of the method (output)
+*/
+static acpi_status get_handle(const char *method, acpi_handle *handle)
+{
+    struct handle_entry *entry;
+    acpi_status status;
+    size_t len = strlen(method);
+    u32 hash;
+
+    if (!handle_cache_enabled())
+        return acpi_get_handle(NULL, (acpi_string) method, handle);
+
+    hash = jhash(method, len, 0);
+
+    mutex_lock(&handle_cache_lock);
+
+    hash_for_each_possible(handle_cache, entry, node, hash) {
+        if (entry->hash == hash && !strcmp(entry->path, method)) {
+            *handle = entry->handle;
+            handle_cache_hits++;
+            mutex_unlock(&handle_cache_lock);
+            return AE_OK;
+        }
+    }
+
+    handle_cache_misses++;
+
+    // resolve under the lock, so a flush cannot miss a handle being added
+    status = acpi_get_handle(NULL, (acpi_string) method, handle);
+    if (ACPI_SUCCESS(status) && handle_cache_count < HANDLE_CACHE_MAX) {
+        entry = kmalloc(sizeof(*entry) + len + 1, GFP_KERNEL);
+        if (entry) {
+            entry->hash = hash;
+            entry->handle = *handle;
+            memcpy(entry->path, method, len + 1);
+            hash_add(handle_cache, &entry->node, hash);
+            handle_cache_count++;
+        }
+    }
+
+    mutex_unlock(&handle_cache_lock);
+
+    return status;
+}
+
+/** ACPICA table handler, called when a table is loaded or unloaded
+*/
+static acpi_status handle_cache_table_event(u32 event, void *table, void *context)
+{
+    flush_handle_cache();
+    flush_result_cache();
+    return AE_OK;
+}
+
+/** Hooks the caches up to namespace changes. Only the ACPICA table handler hears about
+every table load and unload, and it is exclusive and usually owned by the ACPI core.
+Without it nothing flushes a handle whose table was unloaded, which is why the handle
+cache is opt-in
+*/
+static void init_handle_cache(void)
+{
+    handle_cache_table_handler = ACPI_SUCCESS(acpi_install_table_handler(handle_cache_table_event, NULL));
+
+    if (handle_cache_enabled() && !handle_cache_table_handler)
+        printk(KERN_INFO "acpi_call: Cannot watch ACPI tables, cached handles are not flushed when a table is unloaded\n");
+}
+
+static void exit_handle_cache(void)
+{
+    if (handle_cache_table_handler)
+        acpi_remove_table_handler(handle_cache_table_event);
+
+    flush_handle_cache();
+}
+
+/** Adds an evaluation to the histogram of its method path
+*/
+static void record_latency(const char *method, acpi_status status, u64 duration_ns)
+{
+    struct latency_hist *hist = NULL;
+    int i;
+
+    mutex_lock(&latency_lock);
+
+    for (i = 0; i < latency_count; i++) {
+        if (!strncmp(latency_hists[i].path, method, LATENCY_PATH_LEN - 1)) {
+            hist = &latency_hists[i];
+            break;
+        }
+    }
+
+    if (!hist) {
+        if (latency_count < LATENCY_PATHS) {
+            hist = &latency_hists[latency_count++];
+            snprintf(hist->path, sizeof(hist->path), "%s", method);
+        } else {
+            hist = &latency_other;
+        }
+    }
+
+    i = min_t(int, fls64(div_u64(duration_ns, NSEC_PER_USEC)), LATENCY_BUCKETS - 1);
+
+    hist->calls++;
+    if (ACPI_FAILURE(status))
+        hist->errors++;
+    hist->total_ns += duration_ns;
+    hist->max_ns = max(hist->max_ns, duration_ns);
+    hist->buckets[i]++;
+
+    mutex_unlock(&latency_lock);
+}
+
+static void show_latency_hist(struct seq_file *m, struct latency_hist *hist)
+{
+    int i;
+
+    seq_printf(m, "%s calls=%llu errors=%llu avg_us=%llu max_us=%llu\n ",
+        hist->path, hist->calls, hist->errors,
+        hist->calls ? div64_u64(hist->total_ns, hist->calls) / NSEC_PER_USEC : 0,
+        div_u64(hist->max_ns, NSEC_PER_USEC));
+    for (i = 0; i < LATENCY_BUCKETS; i++)
+        seq_printf(m, " %llu", hist->buckets[i]);
+    seq_putc(m, '\n');
+}
+
+/** debugfs 'latency' show callback. Two lines per method path: the totals, then
+the bucket counts in the order given by the header
+*/
+static int latency_show(struct seq_file *m, void *unused)
+{
+    int i;
+
+    seq_puts(m, "buckets:");
+    for (i = 0; i < LATENCY_BUCKETS - 1; i++)
+        seq_printf(m, " <%uus", 1U << i);
+    seq_printf(m, " >=%uus\n", 1U << (LATENCY_BUCKETS - 2));
+
+    mutex_lock(&latency_lock);
+    for (i = 0; i < latency_count; i++)
+        show_latency_hist(m, &latency_hists[i]);
+    if (latency_other.calls)
+        show_latency_hist(m, &latency_other);
+    mutex_unlock(&latency_lock);
+
+    return 0;
+}
+
+static int latency_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, latency_show, NULL);
+}
+
+static const struct file_operations latency_fops = {
+        .owner    = THIS_MODULE,
+        .open     = latency_open,
+        .read     = seq_read,
+        .llseek   = seq_lseek,
+        .release  = single_release,
+};
+
+/** Ends a result with RESULT_TRUNCATED, every reservation kept room for it. Nothing
+is appended afterwards
+*/
+static void result_truncate(struct result_buffer *rb) {
+    if (rb->data) {
+        memcpy(rb->data + rb->len, RESULT_TRUNCATED, sizeof(RESULT_TRUNCATED));
+        rb->len += sizeof(RESULT_TRUNCATED) - 1;
+    }
+    rb->truncated = true;
+}
+
+/** Makes room for extra more characters, RESULT_TRUNCATED and the terminating nul
+@returns false if the result would exceed RESULT_MAX or memory ran out, the result
+is then truncated
+*/
+static bool result_reserve(struct result_buffer *rb, size_t extra) {
+    size_t needed = rb->len + extra + sizeof(RESULT_TRUNCATED);
+    size_t size = max_t(size_t, rb->size * 2, BUFFER_SIZE);
+    char *data;
+
+    if (needed <= rb->size)
+        return true;
+
+    if (needed > RESULT_MAX) {
+        result_truncate(rb);
+        return false;
+    }
+
+    size = clamp_t(size_t, size, needed, RESULT_MAX);
+    data = krealloc(rb->data, size, GFP_KERNEL);
+    if (!data) {
+        result_truncate(rb);
+        return false;
+    }
+
+    rb->data = data;
+    rb->size = size;
+    return true;
+}
+
+/** Appends formatted text to a result, in time linear to the appended text. Text
+beyond RESULT_MAX is cut off, the part that fits is kept
+*/
+static __printf(2, 3) void result_printf(struct result_buffer *rb, const char *fmt, ...) {
+    va_list args;
+    size_t len, fit;
+
+    if (rb->truncated)
+        return;
+
+    va_start(args, fmt);
+    len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+
+    fit = min_t(size_t, len, RESULT_MAX - sizeof(RESULT_TRUNCATED) - rb->len);
+    if (!result_reserve(rb, fit))
+        return;
+
+    va_start(args, fmt);
+    vsnprintf(rb->data + rb->len, fit + 1, fmt, args);
+    va_end(args);
+    rb->len += fit;
+
+    if (fit < len)
+        result_truncate(rb);
+}
+
+static void result_reset(struct result_buffer *rb) {
+    rb->len = 0;
+    rb->truncated = false;
+    if (rb->data)
+        *rb->data = '\0';
+}
+
+static const char *result_text(const struct result_buffer *rb) {
+    if (!rb->data)
+        return rb->truncated ? RESULT_TRUNCATED : "";
+    return rb->data;
+}
+
+static void result_free(struct result_buffer *rb) {
+    kfree(rb->data);
+    memset(rb, 0, sizeof(*rb));
+}
+
+/** Appends the contents of an acpi_object to a result
+@param rb       The result to append to
+@param result   An acpi object holding result data
+@param depth    Nesting level of the object
+*/
+static void acpi_result_to_string(struct result_buffer *rb, union acpi_object *result, int depth) {
+    int i;
+
+    if (result->type == ACPI_TYPE_INTEGER) {
+        result_printf(rb, "0x%llx", (unsigned long long)result->integer.value);
+    } else if (result->type == ACPI_TYPE_STRING) {
+        result_printf(rb, "\"%.*s\"", (int)result->string.length, result->string.pointer);
+    } else if (result->type == ACPI_TYPE_BUFFER) {
+        // reserve the whole buffer at once, every byte takes up to 6 chars
+        if (rb->len + result->buffer.length * 6 + 2 + sizeof(RESULT_TRUNCATED) <= RESULT_MAX)
+            result_reserve(rb, result->buffer.length * 6 + 2);
+
+        result_printf(rb, "{");
+        for (i = 0; i < result->buffer.length && !rb->truncated; i++)
+            result_printf(rb, "%s0x%02x", i == 0 ? "" : ", ", result->buffer.pointer[i]);
+        result_printf(rb, "}");
+    } else if (result->type == ACPI_TYPE_PACKAGE) {
+        if (depth >= MAX_RESULT_DEPTH) {
+            result_printf(rb, "[...]");
+            return;
+        }
+
+        result_printf(rb, "[");
+        for (i = 0; i < result->package.count && !rb->truncated; i++) {
+            if (i > 0)
+                result_printf(rb, ", ");
+            acpi_result_to_string(rb, &result->package.elements[i], depth + 1);
+        }
+        result_printf(rb, "]");
+    } else {
+        result_printf(rb, "Object type 0x%x\n", result->type);
+    }
+}
+
+/** A cached call result. The key is the method path with its terminating nul,
+followed by the serialized arguments
+*/
+struct result_cache_entry {
+    struct hlist_node node;
+    u32 hash;
+    unsigned long expires;  // jiffies
+    char *result;
+    size_t device_len;      // length of the device part of the path
+    size_t key_len;
+    u8 key[];
+};
+
+struct cache_method {
+    char name[CACHE_METHOD_LEN];
+    int ttl_ms;             // -1 to use cache_ttl_ms
+};
+
+static DEFINE_HASHTABLE(result_cache, RESULT_CACHE_BITS);
+static DEFINE_MUTEX(result_cache_lock);
+static int result_cache_count;
+static u32 result_cache_generation;
+static u64 result_cache_hits;
+static u64 result_cache_misses;
+static u64 result_cache_invalidations;
+
+// allowlist of cacheable methods, protected by result_cache_lock
+static struct cache_method cache_methods[CACHE_METHODS_MAX];
+static int cache_method_count;
+
+static unsigned int cache_ttl_ms = 1000;
+module_param(cache_ttl_ms, uint, 0644);
+MODULE_PARM_DESC(cache_ttl_ms, "Time in ms the result of a cacheable method is reused, unless cache_methods sets one (default: 1000)");
+
+/** Length of the device part of a method path, "\_SB.PCI0.PEG0.PEGP" for
+"\_SB.PCI0.PEG0.PEGP._STA". Methods in the root scope give 0
+*/
+static size_t method_device_len(const char *method)
+{
+    const char *dot = strrchr(method, '.');
+
+    return dot ? dot - method : 0;
+}
+
+/** Looks up the TTL of a method in the allowlist. Entries containing a '.' or
+starting with '\' match the full path, other entries the last name of the path
+@returns The TTL in jiffies, 0 if results of the method are not cached
+*/
+static unsigned long result_cache_ttl(const char *method)
+{
+    size_t device_len = method_device_len(method);
+    const char *name = method + (device_len ? device_len + 1 : 0);
+    unsigned long ttl = 0;
+    int i;
+
+    while (*name == '\\' || *name == '^')
+        name++;
+
+    mutex_lock(&result_cache_lock);
+    for (i = 0; i < cache_method_count; i++) {
+        const char *entry = cache_methods[i].name;
+        bool full = entry[0] == '\\' || strchr(entry, '.');
+
+        if (!strcmp(entry, full ? method : name)) {
+            int ttl_ms = cache_methods[i].ttl_ms;
+
+            ttl = msecs_to_jiffies(ttl_ms < 0 ? cache_ttl_ms : ttl_ms);
+            break;
+        }
+    }
+    mutex_unlock(&result_cache_lock);
+
+    return ttl;
+}
+
+static bool cache_key_append(struct result_buffer *key, const void *data, size_t len)
+{
+    if (!result_reserve(key, len))
+        return false;
+    memcpy(key->data + key->len, data, len);
+    key->len += len;
+    return true;
+}
+
+/** Serializes an argument into a cache key, every value is preceded by its
+type and length so different argument lists never give the same key
+*/
+static bool cache_key_add_object(struct result_buffer *key, const union acpi_object *obj)
+{
+    u32 header[2] = { obj->type, 0 };
+    u32 i;
+
+    switch (obj->type) {
+    case ACPI_TYPE_INTEGER:
+        return cache_key_append(key, header, sizeof(header)) &&
+            cache_key_append(key, &obj->integer.value, sizeof(obj->integer.value));
+    case ACPI_TYPE_STRING:
+        header[1] = obj->string.length;
+        return cache_key_append(key, header, sizeof(header)) &&
+            cache_key_append(key, obj->string.pointer, obj->string.length);
+    case ACPI_TYPE_BUFFER:
+        header[1] = obj->buffer.length;
+        return cache_key_append(key, header, sizeof(header)) &&
+            cache_key_append(key, obj->buffer.pointer, obj->buffer.length);
+    case ACPI_TYPE_PACKAGE:
+        header[1] = obj->package.count;
+        if (!cache_key_append(key, header, sizeof(header)))
+            return false;
+        for (i = 0; i < obj->package.count; i++)
+            if (!cache_key_add_object(key, &obj->package.elements[i]))
+                return false;
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool build_cache_key(struct result_buffer *key, const char *method, int argc,
+    const union acpi_object *argv)
+{
+    int i;
+
+    if (!cache_key_append(key, method, strlen(method) + 1))
+        return false;
+    for (i = 0; i < argc; i++)
+        if (!cache_key_add_object(key, &argv[i]))
+            return false;
+    return true;
+}
+
+static void drop_result_cache_entry(struct result_cache_entry *entry)
+{
+    hash_del(&entry->node);
+    kfree(entry->result);
+    kfree(entry);
+    result_cache_count--;
+}
+
+/** Copies a cached result that has not expired yet
+@returns true on a hit
+*/
+static bool result_cache_lookup(const struct result_buffer *key, struct result_buffer *out)
+{
+    struct result_cache_entry *entry;
+    u32 hash = jhash(key->data, key->len, 0);
+    bool hit = false;
+
+    mutex_lock(&result_cache_lock);
+
+    hash_for_each_possible(result_cache, entry, node, hash) {
+        if (entry->hash != hash || entry->key_len != key->len ||
+            memcmp(entry->key, key->data, key->len))
+            continue;
+
+        if (time_before(jiffies, entry->expires)) {
+            result_reset(out);
+            result_printf(out, "%s", entry->result);
+            hit = true;
+        } else {
+            drop_result_cache_entry(entry);
+        }
+        break;
+    }
+
+    if (hit)
+        result_cache_hits++;
+    else
+        result_cache_misses++;
+
+    mutex_unlock(&result_cache_lock);
+
+    return hit;
+}
+
+/** Stores a result unless the cache was invalidated since the call started
+@param generation   The value of result_cache_generation before the call
+*/
+static void result_cache_store(const struct result_buffer *key, unsigned long ttl,
+    u32 generation, const char *result)
+{
+    struct result_cache_entry *entry, *old;
+    struct hlist_node *tmp;
+    int bkt;
+
+    entry = kmalloc(sizeof(*entry) + key->len, GFP_KERNEL);
+    if (!entry)
+        return;
+    entry->result = kstrdup(result, GFP_KERNEL);
+    if (!entry->result) {
+        kfree(entry);
+        return;
+    }
+    entry->hash = jhash(key->data, key->len, 0);
+    entry->expires = jiffies + ttl;
+    entry->device_len = method_device_len(key->data);
+    entry->key_len = key->len;
+    memcpy(entry->key, key->data, key->len);
+
+    mutex_lock(&result_cache_lock);
+
+    if (generation != result_cache_generation)
+        goto out_free;
+
+    hash_for_each_possible_safe(result_cache, old, tmp, node, entry->hash) {
+        if (old->hash == entry->hash && old->key_len == entry->key_len &&
+            !memcmp(old->key, entry->key, entry->key_len))
+            drop_result_cache_entry(old);
+    }
+
+    if (result_cache_count >= RESULT_CACHE_MAX) {
+        hash_for_each_safe(result_cache, bkt, tmp, old, node)
+            if (!time_before(jiffies, old->expires))
+                drop_result_cache_entry(old);
+        if (result_cache_count >= RESULT_CACHE_MAX)
+            goto out_free;
+    }
+
+    hash_add(result_cache, &entry->node, entry->hash);
+    result_cache_count++;
+    mutex_unlock(&result_cache_lock);
+    return;
+
+out_free:
+    mutex_unlock(&result_cache_lock);
+    kfree(entry->result);
+    kfree(entry);
+}
+
+/** Drops the cached results of the device of a method, every result for methods
+in the root scope. Calls still running when this happens do not store their result
+*/
+static void invalidate_result_cache(const char *method)
+{
+    struct result_cache_entry *entry;
+    struct hlist_node *tmp;
+    size_t device_len = method_device_len(method);
+    int bkt;
+
+    mutex_lock(&result_cache_lock);
+    result_cache_generation++;
+    hash_for_each_safe(result_cache, bkt, tmp, entry, node) {
+        if (!device_len || (entry->device_len == device_len &&
+            !memcmp(entry->key, method, device_len))) {
+            drop_result_cache_entry(entry);
+            result_cache_invalidations++;
+        }
+    }
+    mutex_unlock(&result_cache_lock);
+}
+
+static void flush_result_cache(void)
+{
+    struct result_cache_entry *entry;
+    struct hlist_node *tmp;
+    int bkt;
+
+    mutex_lock(&result_cache_lock);
+    result_cache_generation++;
+    hash_for_each_safe(result_cache, bkt, tmp, entry, node)
+        drop_result_cache_entry(entry);
+    mutex_unlock(&result_cache_lock);
+}
+
+/** Sets the cache_methods parameter, a comma separated list of method names or
+paths, each optionally followed by ":ttl_ms". Replaces the allowlist and drops
+every cached result
+*/
+static int cache_methods_set(const char *val, const struct kernel_param *kp)
+{
+    struct cache_method *methods;
+    char *list, *s, *entry;
+    int count = 0, ret = 0;
+
+    methods = kcalloc(CACHE_METHODS_MAX, sizeof(*methods), GFP_KERNEL);
+    list = kstrdup(val, GFP_KERNEL);
+    if (!methods || !list) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    s = strim(list);
+    while ((entry = strsep(&s, ",")) != NULL) {
+        char *ttl = strchr(entry, ':');
+
+        entry = strim(entry);
+        if (!*entry)
+            continue;
+        if (count == CACHE_METHODS_MAX) {
+            ret = -E2BIG;
+            goto out;
+        }
+
+        methods[count].ttl_ms = -1;
+        if (ttl) {
+            unsigned int ttl_ms;
+
+            *ttl++ = 0;
+            if (kstrtouint(strim(ttl), 10, &ttl_ms) || ttl_ms > INT_MAX) {
+                ret = -EINVAL;
+                goto out;
+            }
+            methods[count].ttl_ms = ttl_ms;
+            entry = strim(entry);
+        }
+        if (!*entry || strlen(entry) >= CACHE_METHOD_LEN) {
+            ret = -EINVAL;
+            goto out;
+        }
+        strcpy(methods[count].name, entry);
+        count++;
+    }
+
+    mutex_lock(&result_cache_lock);
+    memcpy(cache_methods, methods, count * sizeof(*methods));
+    cache_method_count = count;
+    mutex_unlock(&result_cache_lock);
+
+    flush_result_cache();
+
+out:
+    kfree(list);
+    kfree(methods);
+    return ret;
+}
+
+static int cache_methods_get(char *buffer, const struct kernel_param *kp)
+{
+    int len = 0, i;
+
+    mutex_lock(&result_cache_lock);
+    for (i = 0; i < cache_method_count; i++) {
+        len += scnprintf(buffer + len, PAGE_SIZE - len, "%s%s", i ? "," : "",
+            cache_methods[i].name);
+        if (cache_methods[i].ttl_ms >= 0)
+            len += scnprintf(buffer + len, PAGE_SIZE - len, ":%d", cache_methods[i].ttl_ms);
+    }
+    mutex_unlock(&result_cache_lock);
+    len += scnprintf(buffer + len, PAGE_SIZE - len, "\n");
+
+    return len;
+}
+
+static const struct kernel_param_ops cache_methods_ops = {
+    .set = cache_methods_set,
+    .get = cache_methods_get,
+};
+module_param_cb(cache_methods, &cache_methods_ops, NULL, 0644);
+MODULE_PARM_DESC(cache_methods, "Comma separated methods whose results are cached, as name or full path with an optional :ttl_ms, e.g. \"_STA,_PSC:5000\" (default: none)");
+
+/** debugfs 'result_cache' show callback. The totals, then one line per cached
+result with the time in ms until it expires
+*/
+static int result_cache_show(struct seq_file *m, void *unused)
+{
+    struct result_cache_entry *entry;
+    u64 lookups;
+    int bkt;
+
+    mutex_lock(&result_cache_lock);
+
+    lookups = result_cache_hits + result_cache_misses;
+    seq_printf(m, "entries=%d hits=%llu misses=%llu hit_rate=%llu%% invalidations=%llu\n",
+        result_cache_count, result_cache_hits, result_cache_misses,
+        lookups ? div64_u64(result_cache_hits * 100, lookups) : 0,
+        result_cache_invalidations);
+
+    hash_for_each(result_cache, bkt, entry, node) {
+        long left = (long) (entry->expires - jiffies);
+
+        seq_printf(m, "%s expires_ms=%u\n", (const char *) entry->key,
+            left > 0 ? jiffies_to_msecs(left) : 0);
+    }
+
+    mutex_unlock(&result_cache_lock);
+
+    return 0;
+}
+
+static int result_cache_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, result_cache_show, NULL);
+}
+
+static const struct file_operations result_cache_fops = {
+        .owner    = THIS_MODULE,
+        .open     = result_cache_open,
+        .read     = seq_read,
+        .llseek   = seq_lseek,
+        .release  = single_release,
+};
+
+/** Resolves and evaluates a method, with tracing and latency accounting
+@param method   The full name of ACPI method to call
+@param argc     The number of parameters
+@param argv     A pre-allocated array of arguments of type acpi_object
+@param buffer   Receives the returned object, to be freed by the caller
+@returns        The ACPI status of the call
+*/
+static acpi_status evaluate_method(const char *method, int argc, union acpi_object *argv,
+    struct acpi_buffer *buffer)
+{
+    acpi_status status;
+    acpi_handle handle;
+    struct acpi_object_list arg;
+    u64 arg0 = 0, duration;
+    ktime_t start;
+    bool cacheable = result_cache_ttl(method) != 0;
+
+#ifdef DEBUG
+    printk(KERN_INFO "acpi_call: Calling %s\n", method);
+#endif
+
+    // get the handle of the method, must be a fully qualified path
+    status = get_handle(method, &handle);
+
+    if (argc > 0 && argv[0].type == ACPI_TYPE_INTEGER)
+        arg0 = argv[0].integer.value;
+
+    if (ACPI_FAILURE(status))
+    {
+        trace_acpi_call_eval(method, argc, arg0, status, 0, 0);
+        printk(KERN_ERR "acpi_call: Cannot get handle: Error: %s\n", acpi_format_exception(status));
+        return status;
+    }
+
+    // prepare parameters
+    arg.count = argc;
+    arg.pointer = argv;
+
+    // other methods may change the state of the device, drop its cached results
+    // before and after the call so no result from in between is kept
+    if (!cacheable)
+        invalidate_result_cache(method);
+
+    // call the method
+    start = ktime_get();
+    status = acpi_evaluate_object(handle, NULL, &arg, buffer);
+    duration = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+    if (!cacheable)
+        invalidate_result_cache(method);
+
+    record_latency(method, status, duration);
+    trace_acpi_call_eval(method, argc, arg0, status,
+        buffer->pointer ? ((union acpi_object *) buffer->pointer)->type : 0, duration);
+
+    if (ACPI_FAILURE(status))
+        printk(KERN_ERR "acpi_call: Method call failed: Error: %s\n", acpi_format_exception(status));
+
+    return status;
+}
+
+/**
+@param ctx      The call context receiving the result
+@param method   The full name of ACPI method to call
+@param argc     The number of parameters
+@param argv     A pre-allocated array of arguments of type acpi_object
+@returns        The ACPI status of the call
+*/
+static acpi_status do_acpi_call(struct call_context *ctx, const char * method, int argc, union acpi_object *argv)
+{
+    struct acpi_buffer buffer = { ACPI_ALLOCATE_BUFFER, NULL };
+    struct result_buffer key = { NULL };
+    unsigned long ttl = result_cache_ttl(method);
+    u32 generation = 0;
+    acpi_status status;
+
+    // results of cacheable methods are reused until they expire
+    if (ttl) {
+        if (!build_cache_key(&key, method, argc, argv)) {
+            ttl = 0;
+        } else if (result_cache_lookup(&key, &ctx->result)) {
+            result_free(&key);
+            return ctx->result.truncated ? AE_BUFFER_OVERFLOW : AE_OK;
+        }
+
+        mutex_lock(&result_cache_lock);
+        generation = result_cache_generation;
+        mutex_unlock(&result_cache_lock);
+    }
+
+    status = evaluate_method(method, argc, argv, &buffer);
+
+    // reset the result buffer
+    result_reset(&ctx->result);
+
+    if (ACPI_FAILURE(status))
+    {
+        result_printf(&ctx->result, "Error: %s", acpi_format_exception(status));
+        result_free(&key);
+        return status;
+    }
+
+    // methods without a return value leave the buffer empty
+    if (buffer.pointer)
+        acpi_result_to_string(&ctx->result, buffer.pointer, 0);
+    else
+        result_printf(&ctx->result, "ok");
+    kfree(buffer.pointer);
+
+    // a cut off result is neither cached nor reported as a successful call
+    if (ctx->result.truncated)
+        status = AE_BUFFER_OVERFLOW;
+    else if (ttl)
+        result_cache_store(&key, ttl, generation, result_text(&ctx->result));
+    result_free(&key);
+
+#ifdef DEBUG
+    printk(KERN_INFO "acpi_call: Call successful: %s\n", result_text(&ctx->result));
+#endif
+
+    return status;
+}
+
+/** State of the argument parser. Arguments are parsed twice: the sizing pass
+(objs == NULL) only counts the objects and data bytes, the fill pass stores the
+argument tree in an arena of exactly that size. Both passes reserve objects and
+data in the same order, so the fill pass never runs out of room
+*/
+struct arg_parser {
+    const char *s;              // current position in the input
+    union acpi_object *objs;    // arena objects, NULL in the sizing pass
+    u8 *data;                   // arena data following the objects
+    size_t nobjs;               // objects reserved so far
+    size_t ndata;               // data bytes reserved so far
+};
+
+static union acpi_object *reserve_objects(struct arg_parser *p, size_t count)
+{
+    union acpi_object *objs = p->objs ? p->objs + p->nobjs : NULL;
+
+    p->nobjs += count;
+    return objs;
+}
+
+static u8 *reserve_data(struct arg_parser *p, size_t len)
+{
+    u8 *data = p->objs ? p->data + p->ndata : NULL;
+
+    p->ndata += len;
+    return data;
+}
+
+static bool is_arg_separator(char c)
+{
+    return c == 0 || isspace(c) || c == ',' || c == ']' || c == '}';
+}
+
+static void skip_spaces_and_commas(struct arg_parser *p)
+{
+    while (isspace(*p->s) || *p->s == ',')
+        p->s++;
+}
+
+/** Parses an integer token, N, -N or 0xN
+*/
+static int parse_integer(struct arg_parser *p, u64 *value)
+{
+    const char *start = p->s;
+    char token[24];
+    size_t len;
+
+    while (!is_arg_separator(*p->s))
+        p->s++;
+
+    len = p->s - start;
+    if (len == 0 || len >= sizeof(token))
+        return -EINVAL;
+    memcpy(token, start, len);
+    token[len] = 0;
+
+    if (token[0] == '-') {
+        s64 v;
+
+        if (kstrtos64(token, 10, &v))
+            return -EINVAL;
+        *value = v;
+        return 0;
+    }
+    if (token[0] == '0' && (token[1] == 'x' || token[1] == 'X'))
+        return kstrtou64(token + 2, 16, value) ? -EINVAL : 0;
+    return kstrtou64(token, 10, value) ? -EINVAL : 0;
+}
+
+static int parse_value(struct arg_parser *p, union acpi_object *obj, int depth);
+
+/** Parses the elements of a package up to and including the closing ']'
+@param elements The element objects to fill, NULL to only count the elements
+@returns        The number of elements, a negative error code if malformed
+*/
+static int parse_elements(struct arg_parser *p, union acpi_object *elements, int depth)
+{
+    int count = 0;
+
+    for (;;) {
+        int ret;
+
+        skip_spaces_and_commas(p);
+        if (*p->s == ']') {
+            p->s++;
+            return count;
+        }
+        if (*p->s == 0)
+            return -EINVAL;
+
+        ret = parse_value(p, elements ? &elements[count] : NULL, depth);
+        if (ret)
+            return ret;
+        count++;
+
+        if (!is_arg_separator(*p->s) || *p->s == '}')
+            return -EINVAL;
+    }
+}
+
+/** Parses one argument:
+- "string"
+- bXXXX, a buffer in hex
+- {b1, b2, ...}, a buffer of byte values
+- [v1, v2, ...], a package of any of these, nested up to ACPI_CALL_MAX_DEPTH
+- N, -N or 0xN, an integer
+@param obj The object to fill, NULL in the sizing pass
+*/
+static int parse_value(struct arg_parser *p, union acpi_object *obj, int depth)
+{
+    if (*p->s == '"') {
+        // string, up to the next ", stored NUL terminated
+        const char *start = ++p->s;
+        const char *end = strchr(start, '"');
+        size_t len;
+        char *str;
+
+        if (!end)
+            return -EINVAL;
+        len = end - start;
+        str = (char *) reserve_data(p, len + 1);
+        if (obj) {
+            memcpy(str, start, len);
+            str[len] = 0;
+            obj->type = ACPI_TYPE_STRING;
+            obj->string.pointer = str;
+            obj->string.length = len;
+        }
+        p->s = end + 1;
+    } else if (*p->s == 'b') {
+        // buffer - bXXXX
+        const char *start = ++p->s;
+        size_t len, i;
+        u8 *buf;
+
+        while (!is_arg_separator(*p->s))
+            p->s++;
+        len = p->s - start;
+        if (len % 2 == 1)
+            return -EINVAL;
+        len /= 2;
+
+        buf = reserve_data(p, len);
+        for (i = 0; i < len; i++) {
+            int hi = hex_to_bin(start[i * 2]);
+            int lo = hex_to_bin(start[i * 2 + 1]);
+
+            if (hi < 0 || lo < 0)
+                return -EINVAL;
+            if (buf)
+                buf[i] = (hi << 4) | lo;
+        }
+        if (obj) {
+            obj->type = ACPI_TYPE_BUFFER;
+            obj->buffer.pointer = buf;
+            obj->buffer.length = len;
+        }
+    } else if (*p->s == '{') {
+        // buffer - { b1, b2 ...}, the bytes are reserved one by one and end up
+        // contiguous as nothing else is reserved in between
+        u8 *buf = p->objs ? p->data + p->ndata : NULL;
+        u32 len = 0;
+
+        p->s++;
+        for (;;) {
+            u64 value;
+            u8 *byte;
+
+            skip_spaces_and_commas(p);
+            if (*p->s == '}') {
+                p->s++;
+                break;
+            }
+            if (parse_integer(p, &value) || value > 0xff)
+                return -EINVAL;
+            byte = reserve_data(p, 1);
+            if (byte)
+                *byte = value;
+            len++;
+        }
+        if (obj) {
+            obj->type = ACPI_TYPE_BUFFER;
+            obj->buffer.pointer = buf;
+            obj->buffer.length = len;
+        }
+    } else if (*p->s == '[') {
+        // package - [ v1, v2 ...]
+        union acpi_object *elements;
+        int count;
+
+        if (depth >= ACPI_CALL_MAX_DEPTH)
+            return -EINVAL;
+        p->s++;
+
+        if (!p->objs) {
+            count = parse_elements(p, NULL, depth + 1);
+            if (count < 0)
+                return count;
+            reserve_objects(p, count);
+            return 0;
+        }
+
+        // the elements must be contiguous, count them before reserving them
+        {
+            struct arg_parser scan = { .s = p->s };
+
+            count = parse_elements(&scan, NULL, depth + 1);
+            if (count < 0)
+                return count;
+        }
+        elements = reserve_objects(p, count);
+        if (parse_elements(p, elements, depth + 1) != count)
+            return -EINVAL;
+
+        obj->type = ACPI_TYPE_PACKAGE;
+        obj->package.count = count;
+        obj->package.elements = elements;
+    } else {
+        u64 value;
+
+        if (parse_integer(p, &value))
+            return -EINVAL;
+        if (obj) {
+            obj->type = ACPI_TYPE_INTEGER;
+            obj->integer.value = value;
+        }
+    }
+
+    return 0;
+}
+
+/** Parses the space separated arguments of a call
+@param argv The argument objects to fill, NULL in the sizing pass
+@returns    The number of arguments, a negative error code if malformed
+*/
+static int parse_arg_list(struct arg_parser *p, union acpi_object *argv)
+{
+    int argc = 0;
+
+    for (;;) {
+        int ret;
+
+        while (isspace(*p->s))
+            p->s++;
+        if (*p->s == 0)
+            return argc;
+        if (argc == MAX_ACPI_ARGS)
+            return -E2BIG;
+
+        ret = parse_value(p, argv ? &argv[argc] : NULL, 0);
+        if (ret)
+            return ret;
+        argc++;
+
+        if (*p->s && !isspace(*p->s))
+            return -EINVAL;
+    }
+}
+
+/** Parses method name and arguments. The whole argument tree is allocated
+from a single arena, free it with kfree(*args)
+@param input  Input string to be parsed. The method name is NUL terminated in place.
+@param method Set to the method name (output)
+@param nargs  Set to number of arguments parsed (output)
+@param args   Set to the arguments, NULL if there are none (output)
+@returns      0 on success, -EINVAL or -E2BIG if malformed, -ENOMEM
+*/
+static int parse_acpi_args(char *input, char **method, int *nargs, union acpi_object **args)
+{
+    struct arg_parser p;
+    char *s = input;
+    size_t nobjs, ndata, size;
+    int argc;
+
+    *method = input;
+    *nargs = 0;
+    *args = NULL;
+
+    // the method name is separated from the arguments by a space
+    while (*s && *s != ' ')
+        s++;
+    if (*s == 0)
+        return 0;
+    *s++ = 0;
+
+    memset(&p, 0, sizeof(p));
+    p.s = s;
+    argc = parse_arg_list(&p, NULL);
+    if (argc <= 0)
+        return argc;
 
-#define BUFFER_SIZE 256
-#define MAX_ACPI_ARGS 16
+    nobjs = argc + p.nobjs;
+    ndata = p.ndata;
+    size = nobjs * sizeof(union acpi_object) + ndata;
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 10, 0)
-#define HAVE_PROC_CREATE
+    memset(&p, 0, sizeof(p));
+    p.s = s;
+    p.objs = kmalloc(size, GFP_KERNEL);
+    if (!p.objs)
+        return -ENOMEM;
+    p.data = (u8 *) (p.objs + nobjs);
+    reserve_objects(&p, argc);
+
+    if (parse_arg_list(&p, p.objs) != argc || WARN_ON(p.nobjs != nobjs || p.ndata != ndata)) {
+        kfree(p.objs);
+        return -EINVAL;
+    }
+
+    *nargs = argc;
+    *args = p.objs;
+    return 0;
+}
+
+static struct call_context *get_call_context(struct file *filp)
+{
+#ifdef HAVE_PROC_CREATE
+    return filp->private_data;
+#else
+    return &legacy_context;
 #endif
+}
 
-extern struct proc_dir_entry *acpi_root_dir;
+static void init_call_context(struct call_context *ctx)
+{
+    mutex_init(&ctx->lock);
+    ctx->called = false;
+    ctx->batch = false;
+    ctx->drained = false;
+    memset(&ctx->result, 0, sizeof(ctx->result));
+    memset(&ctx->batch_result, 0, sizeof(ctx->batch_result));
+    result_printf(&ctx->result, "not called");
 
-static char result_buffer[BUFFER_SIZE];
+    spin_lock_init(&ctx->async_lock);
+    INIT_LIST_HEAD(&ctx->async_calls);
+    init_waitqueue_head(&ctx->async_wait);
+    ctx->async_next_id = 0;
+    ctx->async_count = 0;
+}
 
-static u8 temporary_buffer[BUFFER_SIZE];
+static void release_call_context(struct call_context *ctx)
+{
+    result_free(&ctx->result);
+    result_free(&ctx->batch_result);
+}
 
-static size_t get_avail_bytes(void) {
-    return BUFFER_SIZE - strlen(result_buffer);
+static struct result_buffer *get_output(struct call_context *ctx)
+{
+    return ctx->batch ? &ctx->batch_result : &ctx->result;
 }
-static char *get_buffer_end(void) {
-    return result_buffer + strlen(result_buffer);
+
+/** Publishes the result of a call for files that did not call anything
+*/
+static void publish_result(struct call_context *ctx)
+{
+    mutex_lock(&last_result_lock);
+    result_reset(&last_result);
+    result_printf(&last_result, "%s", result_text(get_output(ctx)));
+    mutex_unlock(&last_result_lock);
 }
 
-/** Appends the contents of an acpi_object to the result buffer
-@param result   An acpi object holding result data
-@returns        0 if the result could fully be saved, a higher value otherwise
+/** Parses and executes one call, the result ends up in the result buffer
+@param ctx  The call context
+@param line The method name and arguments. Modified in the process.
+@returns    0 if the call succeeded, a negative error code otherwise
 */
-static int acpi_result_to_string(union acpi_object *result) {
-    if (result->type == ACPI_TYPE_INTEGER) {
-        snprintf(get_buffer_end(), get_avail_bytes(),
-            "0x%x", (int)result->integer.value);
-    } else if (result->type == ACPI_TYPE_STRING) {
-        snprintf(get_buffer_end(), get_avail_bytes(),
-            "\"%*s\"", result->string.length, result->string.pointer);
-    } else if (result->type == ACPI_TYPE_BUFFER) {
-        int i;
-        // do not store more than data if it does not fit. The first element is
-        // just 4 chars, but there is also two bytes from the curly brackets
-        int show_values = min((size_t)result->buffer.length, get_avail_bytes() / 6);
-
-        sprintf(get_buffer_end(), "{");
-        for (i = 0; i < show_values; i++)
-            sprintf(get_buffer_end(),
-                i == 0 ? "0x%02x" : ", 0x%02x", result->buffer.pointer[i]);
-
-        if (result->buffer.length > show_values) {
-            // if data was truncated, show a trailing comma if there is space
-            snprintf(get_buffer_end(), get_avail_bytes(), ",");
-            return 1;
-        } else {
-            // in case show_values == 0, but the buffer is too small to hold
-            // more values (i.e. the buffer cannot have anything more than "{")
-            snprintf(get_buffer_end(), get_avail_bytes(), "}");
-        }
-    } else if (result->type == ACPI_TYPE_PACKAGE) {
-        int i;
-        sprintf(get_buffer_end(), "[");
-        for (i=0; i<result->package.count; i++) {
-            if (i > 0)
-                snprintf(get_buffer_end(), get_avail_bytes(), ", ");
+static int run_call(struct call_context *ctx, char *line)
+{
+    union acpi_object *args;
+    acpi_status status;
+    char *method;
+    int nargs, ret;
 
-            // abort if there is no more space available
-            if (!get_avail_bytes() || acpi_result_to_string(&result->package.elements[i]))
-                return 1;
-        }
-        snprintf(get_buffer_end(), get_avail_bytes(), "]");
-    } else {
-        snprintf(get_buffer_end(), get_avail_bytes(),
-            "Object type 0x%x\n", result->type);
+    ret = parse_acpi_args(line, &method, &nargs, &args);
+    if (ret) {
+        result_reset(&ctx->result);
+        if (ret == -ENOMEM)
+            result_printf(&ctx->result, "Error: out of memory");
+        else
+            result_printf(&ctx->result, "Error: invalid arguments");
+        return ret;
     }
 
-    // return 0 if there are still bytes available, 1 otherwise
-    return !get_avail_bytes();
+    status = do_acpi_call(ctx, method, nargs, args);
+    kfree(args);
+
+    return ACPI_FAILURE(status) ? -EIO : 0;
 }
 
-/**
-@param method   The full name of ACPI method to call
-@param argc     The number of parameters
-@param argv     A pre-allocated array of arguments of type acpi_object
+/** Executes the calls of a batch in order, one per line. A "stop_on_error" line
+makes the batch stop at the first failed call. The result of every executed call
+is appended to the batch buffer as "[index] result"
 */
-static void do_acpi_call(const char * method, int argc, union acpi_object *argv)
+static void run_batch(struct call_context *ctx, char *input)
 {
-    acpi_status status;
-    acpi_handle handle;
-    struct acpi_object_list arg;
-    struct acpi_buffer buffer = { ACPI_ALLOCATE_BUFFER, NULL };
+    bool stop_on_error = false;
+    int index = 0, ret;
+    char *line;
 
-#ifdef DEBUG
-    printk(KERN_INFO "acpi_call: Calling %s\n", method);
-#endif
+    result_reset(&ctx->batch_result);
 
-    // get the handle of the method, must be a fully qualified path
-    status = acpi_get_handle(NULL, (acpi_string) method, &handle);
+    while ((line = strsep(&input, "\n")) != NULL) {
+        line = strim(line);
+        if (!*line)
+            continue;
 
-    if (ACPI_FAILURE(status))
-    {
-        snprintf(result_buffer, BUFFER_SIZE, "Error: %s", acpi_format_exception(status));
-        printk(KERN_ERR "acpi_call: Cannot get handle: %s\n", result_buffer);
-        return;
+        if (!strcmp(line, "stop_on_error")) {
+            stop_on_error = true;
+            continue;
+        }
+
+        if (index == MAX_BATCH_CALLS) {
+            result_printf(&ctx->batch_result, "[%d] Error: too many calls\n", index);
+            break;
+        }
+
+        ret = run_call(ctx, line);
+        result_printf(&ctx->batch_result, "[%d] %s\n", index++, result_text(&ctx->result));
+
+        // calls whose results cannot be shown any more are not executed
+        if (ctx->batch_result.truncated || (ret && stop_on_error))
+            break;
     }
+}
 
-    // prepare parameters
-    arg.count = argc;
-    arg.pointer = argv;
+/** Executes the input of a write, a single line is one call and several lines
+are executed as a batch
+*/
+static void execute_input(struct call_context *ctx, char *input)
+{
+    ctx->batch = strchr(input, '\n') != NULL || !strncmp(input, "stop_on_error", 13);
+    if (ctx->batch)
+        run_batch(ctx, input);
+    else
+        run_call(ctx, input);
 
-    // call the method
-    status = acpi_evaluate_object(handle, NULL, &arg, &buffer);
-    if (ACPI_FAILURE(status))
-    {
-        snprintf(result_buffer, BUFFER_SIZE, "Error: %s", acpi_format_exception(status));
-        printk(KERN_ERR "acpi_call: Method call failed: %s\n", result_buffer);
-        return;
+    ctx->called = true;
+    publish_result(ctx);
+}
+
+#ifdef HAVE_PROC_CREATE
+/** Workqueue callback executing an asynchronous call. Every call gets its own
+scratch context, so the calls of a file do not wait for each other
+*/
+static void async_call_work(struct work_struct *work)
+{
+    struct async_call *call = container_of(work, struct async_call, work);
+    struct call_context *owner = call->owner;
+    struct call_context *ctx = kmalloc(sizeof(*ctx), GFP_KERNEL);
+    char *result = NULL;
+
+    if (ctx) {
+        init_call_context(ctx);
+        execute_input(ctx, call->input);
+        result = kasprintf(GFP_KERNEL, "%u %s\n", call->id, result_text(get_output(ctx)));
+        release_call_context(ctx);
+        kfree(ctx);
     }
 
-    // reset the result buffer
-    *result_buffer = '\0';
-    acpi_result_to_string(buffer.pointer);
-    kfree(buffer.pointer);
+    kfree(call->input);
+    call->input = NULL;
 
-#ifdef DEBUG
-    printk(KERN_INFO "acpi_call: Call successful: %s\n", result_buffer);
-#endif
+    spin_lock(&owner->async_lock);
+    call->result = result;
+    call->len = result ? strlen(result) : 0;
+    call->done = true;
+    spin_unlock(&owner->async_lock);
+
+    wake_up_interruptible(&owner->async_wait);
 }
 
-/** Decodes 2 hex characters to an u8 int
+/** Queues a call and returns at once. The calls of a file are numbered from 1
+in the order they were written, results are read as "id result" lines
+@param input    The call, owned by the queued call on success
 */
-u8 decodeHex(char *hex) {
-    char buf[3] = { hex[0], hex[1], 0};
-    return (u8) simple_strtoul(buf, NULL, 16);
+static int queue_async_call(struct call_context *ctx, char *input)
+{
+    struct async_call *call = kzalloc(sizeof(*call), GFP_KERNEL);
+
+    if (!call)
+        return -ENOMEM;
+
+    call->owner = ctx;
+    call->input = input;
+    INIT_WORK(&call->work, async_call_work);
+
+    spin_lock(&ctx->async_lock);
+    if (ctx->async_count >= MAX_ASYNC_CALLS) {
+        spin_unlock(&ctx->async_lock);
+        kfree(call);
+        return -EAGAIN;
+    }
+    call->id = ++ctx->async_next_id;
+    list_add_tail(&call->node, &ctx->async_calls);
+    ctx->async_count++;
+    spin_unlock(&ctx->async_lock);
+
+    // AML methods may run for hundreds of milliseconds
+    queue_work(system_unbound_wq, &call->work);
+
+    return 0;
 }
 
-/** Parses method name and arguments
-@param input Input string to be parsed. Modified in the process.
-@param nargs Set to number of arguments parsed (output)
-@param args
+/** Returns the finished asynchronous calls as "id result" lines, as many as fit.
+A line that does not fit is split, its rest is returned first by the next read
 */
-static char *parse_acpi_args(char *input, int *nargs, union acpi_object **args)
+static ssize_t read_async_results(struct call_context *ctx, char __user *buff, size_t count)
 {
-    char *s = input;
+    struct async_call *call, *tmp;
+    LIST_HEAD(finished);
+    char oom[32];
+    size_t used = 0;
+    ssize_t ret;
+    char *out;
 
-    *nargs = 0;
-    *args = NULL;
+    if (!count)
+        return 0;
 
-    // the method name is separated from the arguments by a space
-    while (*s && *s != ' ')
-        s++;
-    // if no space is found, return 0 arguments
-    if (*s == 0)
-        return input;
+    count = min_t(size_t, count, ASYNC_READ_MAX);
+    out = kmalloc(count, GFP_KERNEL);
+    if (!out)
+        return -ENOMEM;
 
-    *args = (union acpi_object *) kmalloc(MAX_ACPI_ARGS * sizeof(union acpi_object), GFP_KERNEL);
+    spin_lock(&ctx->async_lock);
+    list_for_each_entry_safe(call, tmp, &ctx->async_calls, node) {
+        const char *line = call->result;
+        size_t len = call->len, n;
 
-    while (*s) {
-        if (*s == ' ') {
-            if (*nargs == 0)
-                *s = 0; // change first space to nul
-            ++ *nargs;
-            ++ s;
-        } else {
-            union acpi_object *arg = (*args) + (*nargs - 1);
-            if (*s == '"') {
-                // decode string
-                arg->type = ACPI_TYPE_STRING;
-                arg->string.pointer = ++s;
-                arg->string.length = 0;
-                while (*s && *s++ != '"')
-                    arg->string.length ++;
-                // skip the last "
-                ++s;
-            } else if (*s == 'b') {
-                // decode buffer - bXXXX
-                char *p = ++s;
-                int len = 0, i;
-                u8 *buf = NULL;
-
-                while (*p && *p!=' ')
-                    p++;
-
-                len = p - s;
-                if (len % 2 == 1) {
-                    printk(KERN_ERR "acpi_call: buffer arg%d is not multiple of 8 bits\n", *nargs);
-                    return NULL;
-                }
-                len /= 2;
-
-                buf = (u8*) kmalloc(len, GFP_KERNEL);
-                for (i=0; i<len; i++) {
-                    buf[i] = decodeHex(s + i*2);
-                }
-                s = p;
-
-                arg->type = ACPI_TYPE_BUFFER;
-                arg->buffer.pointer = buf;
-                arg->buffer.length = len;
-            } else if (*s == '{') {
-                // decode buffer - { b1, b2 ...}
-                u8 *buf = temporary_buffer;
-                arg->type = ACPI_TYPE_BUFFER;
-                arg->buffer.pointer = buf;
-                arg->buffer.length = 0;
-                while (*s && *s++ != '}') {
-                    if (buf >= temporary_buffer + sizeof(temporary_buffer)) {
-                        printk(KERN_ERR "acpi_call: buffer arg%d is truncated because the buffer is full\n", *nargs);
-                        // clear remaining arguments
-                        while (*s && *s != '}')
-                            ++s;
-                        break;
-                    }
-                    else if (*s >= '0' && *s <= '9') {
-                        // decode integer into buffer
-                        arg->buffer.length ++;
-                        if (s[0] == '0' && s[1] == 'x')
-                            *buf++ = simple_strtol(s+2, 0, 16);
-                        else
-                            *buf++ = simple_strtol(s, 0, 10);
-                    }
-                    // skip until space or comma or '}'
-                    while (*s && *s != ' ' && *s != ',' && *s != '}')
-                        ++s;
-                }
-                // store the result in new allocated buffer
-                buf = (u8*) kmalloc(arg->buffer.length, GFP_KERNEL);
-                memcpy(buf, temporary_buffer, arg->buffer.length);
-                arg->buffer.pointer = buf;
-            } else {
-                // decode integer, N or 0xN
-                arg->type = ACPI_TYPE_INTEGER;
-                if (s[0] == '0' && s[1] == 'x') {
-                    arg->integer.value = simple_strtol(s+2, 0, 16);
-                } else {
-                    arg->integer.value = simple_strtol(s, 0, 10);
-                }
-                while (*s && *s != ' ') {
-                    ++s;
-                }
-            }
+        if (!call->done)
+            continue;
+        if (used == count)
+            break;
+
+        if (!line) {
+            len = scnprintf(oom, sizeof(oom), "%u Error: out of memory\n", call->id);
+            line = oom;
         }
+
+        n = min(len - call->pos, count - used);
+        memcpy(out + used, line + call->pos, n);
+        used += n;
+        call->pos += n;
+
+        if (call->pos < len) {
+            // keep the rest in front of calls finishing in the meantime
+            list_move(&call->node, &ctx->async_calls);
+            break;
+        }
+
+        list_move_tail(&call->node, &finished);
+        ctx->async_count--;
     }
+    spin_unlock(&ctx->async_lock);
+
+    list_for_each_entry_safe(call, tmp, &finished, node) {
+        kfree(call->result);
+        kfree(call);
+    }
+
+    if (used)
+        ret = copy_to_user(buff, out, used) ? -EFAULT : used;
+    else
+        ret = -EAGAIN;
+
+    kfree(out);
+    return ret;
+}
+
+/** Waits for all asynchronous calls of a file and frees them
+*/
+static void free_async_calls(struct call_context *ctx)
+{
+    struct async_call *call, *tmp;
+    LIST_HEAD(calls);
+
+    spin_lock(&ctx->async_lock);
+    list_splice_init(&ctx->async_calls, &calls);
+    spin_unlock(&ctx->async_lock);
 
-    return input;
+    list_for_each_entry_safe(call, tmp, &calls, node) {
+        flush_work(&call->work);
+        kfree(call->result);
+        kfree(call);
+    }
 }
+#endif
 
 /** procfs write callback. Called when writing into /proc/acpi/call.
+A single line is one call, several lines are executed as a batch. Files opened
+with O_NONBLOCK queue the call and return at once, see queue_async_call()
 */
 #ifdef HAVE_PROC_CREATE
 static ssize_t acpi_proc_write( struct file *filp, const char __user *buff,
@@ -264,63 +1605,164 @@ static int acpi_proc_write( struct file *filp, const char __user *buff,
     unsigned long len, void *data )
 #endif
 {
-    char input[2 * BUFFER_SIZE] = { '\0' };
-    union acpi_object *args;
-    int nargs, i;
-    char *method;
+    struct call_context *ctx = get_call_context(filp);
+    char *input;
 
-    if (len > sizeof(input) - 1) {
+    if (len > BATCH_INPUT_SIZE - 1) {
         printk(KERN_ERR "acpi_call: Input too long! (%lu)\n", len);
         return -ENOSPC;
     }
 
+    input = kmalloc(len + 1, GFP_KERNEL);
+    if (!input)
+        return -ENOMEM;
+
     if (copy_from_user( input, buff, len )) {
+        kfree(input);
         return -EFAULT;
     }
     input[len] = '\0';
-    if (input[len-1] == '\n')
+    if (len > 0 && input[len-1] == '\n')
         input[len-1] = '\0';
 
-    method = parse_acpi_args(input, &nargs, &args);
-    if (method) {
-        do_acpi_call(method, nargs, args);
-        if (args) {
-            for (i=0; i<nargs; i++)
-                if (args[i].type == ACPI_TYPE_BUFFER)
-                    kfree(args[i].buffer.pointer);
-            kfree(args);
+#ifdef HAVE_PROC_CREATE
+    if (filp->f_flags & O_NONBLOCK) {
+        int ret = queue_async_call(ctx, input);
+
+        if (ret) {
+            kfree(input);
+            return ret;
         }
+        return len;
     }
+#endif
+
+    mutex_lock(&ctx->lock);
+    execute_input(ctx, input);
+    mutex_unlock(&ctx->lock);
+
+    kfree(input);
 
     return len;
 }
 
 /** procfs 'call' read callback. Called when reading the content of /proc/acpi/call.
-Returns the last call status:
+Returns the last call status of this file, or of the latest call through any
+file if nothing was called through this one:
 - "not called" when no call was previously issued
 - "failed" if the call failed
 - "ok" if the call succeeded
+Files opened with O_NONBLOCK read the results of their asynchronous calls
+instead, see read_async_results()
 */
 #ifdef HAVE_PROC_CREATE
 static ssize_t acpi_proc_read( struct file *filp, char __user *buff,
             size_t count, loff_t *off )
 {
+    struct call_context *ctx = get_call_context(filp);
+    struct result_buffer *out;
     ssize_t ret;
-    int len = strlen(result_buffer);
 
-    // output the current result buffer
-    ret = simple_read_from_buffer(buff, count, off, result_buffer, len + 1);
+    if (filp->f_flags & O_NONBLOCK)
+        return read_async_results(ctx, buff, count);
 
-    // initialize the result buffer for later
-    strcpy(result_buffer, "not called");
+    mutex_lock(&ctx->lock);
+
+    // a result read to the end is gone, continued reads see the end of file
+    if (*off == 0) {
+        ctx->drained = false;
+    } else if (ctx->drained) {
+        mutex_unlock(&ctx->lock);
+        return 0;
+    }
+
+    if (ctx->called) {
+        out = get_output(ctx);
+
+        // output the current result buffer, large results take several reads
+        ret = simple_read_from_buffer(buff, count, off, result_text(out), out->len + 1);
+
+        // initialize the result buffer for later
+        if (*off >= out->len + 1) {
+            result_reset(&ctx->result);
+            result_printf(&ctx->result, "not called");
+            ctx->batch = false;
+            ctx->drained = true;
+        }
+    } else {
+        mutex_lock(&last_result_lock);
+        ret = simple_read_from_buffer(buff, count, off, result_text(&last_result), last_result.len + 1);
+        if (*off >= last_result.len + 1) {
+            result_reset(&last_result);
+            result_printf(&last_result, "not called");
+            ctx->drained = true;
+        }
+        mutex_unlock(&last_result_lock);
+    }
+
+    mutex_unlock(&ctx->lock);
 
     return ret;
 }
 
+/** procfs open callback. Every open file gets its own call context
+*/
+static int acpi_proc_open(struct inode *inode, struct file *filp)
+{
+    struct call_context *ctx = kmalloc(sizeof(*ctx), GFP_KERNEL);
+
+    if (!ctx)
+        return -ENOMEM;
+
+    init_call_context(ctx);
+    filp->private_data = ctx;
+
+    return 0;
+}
+
+static int acpi_proc_release(struct inode *inode, struct file *filp)
+{
+    free_async_calls(filp->private_data);
+    release_call_context(filp->private_data);
+    kfree(filp->private_data);
+    return 0;
+}
+
+/** procfs poll callback. Files opened with O_NONBLOCK are readable while an
+asynchronous call has a result waiting, other files always
+*/
+static unsigned int acpi_proc_poll(struct file *filp, poll_table *wait)
+{
+    struct call_context *ctx = get_call_context(filp);
+    unsigned int mask = POLLOUT | POLLWRNORM;
+    struct async_call *call;
+
+    // a blocking read returns the result of the last call at once, so the file is
+    // always readable, as it was before there was a poll callback
+    if (!(filp->f_flags & O_NONBLOCK))
+        return mask | POLLIN | POLLRDNORM;
+
+    poll_wait(filp, &ctx->async_wait, wait);
+
+    spin_lock(&ctx->async_lock);
+    list_for_each_entry(call, &ctx->async_calls, node) {
+        if (call->done) {
+            mask |= POLLIN | POLLRDNORM;
+            break;
+        }
+    }
+    spin_unlock(&ctx->async_lock);
+
+    return mask;
+}
+
 static struct file_operations proc_acpi_operations = {
         .owner    = THIS_MODULE,
+        .open     = acpi_proc_open,
         .read     = acpi_proc_read,
         .write    = acpi_proc_write,
+        .poll     = acpi_proc_poll,
+        .release  = acpi_proc_release,
 };
 
 #else
@@ -334,17 +1776,299 @@ static int acpi_proc_read(char *page, char **start, off_t off,
         return 0;
     }
 
-    // output the current result buffer
-    len = strlen(result_buffer);
-    memcpy(page, result_buffer, len + 1);
+    // output the current result buffer, as much as fits into the page
+    mutex_lock(&last_result_lock);
+    len = min_t(size_t, last_result.len, PAGE_SIZE - 1);
+    memcpy(page, result_text(&last_result), len);
+    page[len] = '\0';
 
     // initialize the result buffer for later
-    strcpy(result_buffer, "not called");
+    result_reset(&last_result);
+    result_printf(&last_result, "not called");
+    mutex_unlock(&last_result_lock);
 
     return len;
 }
 #endif
 
+/** Frees the package elements of an argument built by object_from_ioctl()
+*/
+static void free_ioctl_object(union acpi_object *obj)
+{
+    u32 i;
+
+    if (obj->type != ACPI_TYPE_PACKAGE)
+        return;
+
+    for (i = 0; i < obj->package.count; i++)
+        free_ioctl_object(&obj->package.elements[i]);
+    kfree(obj->package.elements);
+}
+
+/** Converts a binary argument into an acpi_object. Strings and buffers point into
+the argument buffer, package elements are allocated
+@param args     The argument buffer
+@param size     Size of the argument buffer
+@param src      The binary object, inside the argument buffer
+@param dst      The acpi_object to fill, release it with free_ioctl_object()
+@param depth    Nesting level of the object
+@param budget   Package elements that may still be converted. Elements can be shared
+                between packages, so without it a small buffer expands exponentially
+@returns        0 on success, a negative error code for malformed arguments
+*/
+static int object_from_ioctl(u8 *args, u32 size, const struct acpi_call_object *src,
+    union acpi_object *dst, int depth, u32 *budget)
+{
+    const struct acpi_call_object *elements;
+    u32 i;
+    int ret;
+
+    switch (src->type) {
+    case ACPI_CALL_TYPE_INTEGER:
+        dst->type = ACPI_TYPE_INTEGER;
+        dst->integer.value = src->value;
+        return 0;
+    case ACPI_CALL_TYPE_STRING:
+    case ACPI_CALL_TYPE_BUFFER:
+        if (src->value > size || src->length > size - src->value)
+            return -EINVAL;
+
+        if (src->type == ACPI_CALL_TYPE_STRING) {
+            dst->type = ACPI_TYPE_STRING;
+            dst->string.pointer = (char *) args + src->value;
+            dst->string.length = src->length;
+        } else {
+            dst->type = ACPI_TYPE_BUFFER;
+            dst->buffer.pointer = args + src->value;
+            dst->buffer.length = src->length;
+        }
+        return 0;
+    case ACPI_CALL_TYPE_PACKAGE:
+        if (depth >= ACPI_CALL_MAX_DEPTH || src->value % sizeof(u64) || src->value > size ||
+            src->length > (size - src->value) / sizeof(struct acpi_call_object) ||
+            src->length > *budget)
+            return -EINVAL;
+        *budget -= src->length;
+
+        // elements start out as ACPI_TYPE_ANY, so a partial package is freed correctly
+        dst->type = ACPI_TYPE_PACKAGE;
+        dst->package.count = src->length;
+        dst->package.elements = kcalloc(max_t(u32, src->length, 1), sizeof(union acpi_object), GFP_KERNEL);
+        if (!dst->package.elements) {
+            dst->package.count = 0;
+            return -ENOMEM;
+        }
+
+        elements = (const struct acpi_call_object *) (args + src->value);
+        for (i = 0; i < src->length; i++) {
+            ret = object_from_ioctl(args, size, &elements[i], &dst->package.elements[i], depth + 1, budget);
+            if (ret)
+                return ret;
+        }
+        return 0;
+    default:
+        return -EINVAL;
+    }
+}
+
+/** Size of the data referenced by a result object, without its own header
+*/
+static size_t ioctl_data_size(const union acpi_object *obj, int depth)
+{
+    size_t size;
+    u32 i;
+
+    switch (obj->type) {
+    case ACPI_TYPE_STRING:
+        return ALIGN(obj->string.length + 1, sizeof(u64));
+    case ACPI_TYPE_BUFFER:
+        return ALIGN(obj->buffer.length, sizeof(u64));
+    case ACPI_TYPE_PACKAGE:
+        // deeper packages are returned without elements
+        if (depth >= ACPI_CALL_MAX_DEPTH)
+            return 0;
+
+        size = obj->package.count * sizeof(struct acpi_call_object);
+        for (i = 0; i < obj->package.count; i++)
+            size += ioctl_data_size(&obj->package.elements[i], depth + 1);
+        return size;
+    default:
+        return 0;
+    }
+}
+
+/** Stores a result object in the result buffer
+@param out      The result buffer, sized by ioctl_data_size()
+@param obj      The object to store
+@param hdr      Header of the object inside the result buffer
+@param data     Offset of the next free data byte, advanced past the object's data
+@param depth    Nesting level of the object
+*/
+static void object_to_ioctl(u8 *out, const union acpi_object *obj,
+    struct acpi_call_object *hdr, size_t *data, int depth)
+{
+    struct acpi_call_object *elements;
+    u32 i;
+
+    hdr->type = obj->type;
+    hdr->length = 0;
+    hdr->value = 0;
+
+    switch (obj->type) {
+    case ACPI_TYPE_INTEGER:
+        hdr->value = obj->integer.value;
+        break;
+    case ACPI_TYPE_STRING:
+        hdr->length = obj->string.length;
+        hdr->value = *data;
+        memcpy(out + *data, obj->string.pointer, obj->string.length);
+        out[*data + obj->string.length] = '\0';
+        *data += ALIGN(obj->string.length + 1, sizeof(u64));
+        break;
+    case ACPI_TYPE_BUFFER:
+        hdr->length = obj->buffer.length;
+        hdr->value = *data;
+        memcpy(out + *data, obj->buffer.pointer, obj->buffer.length);
+        *data += ALIGN(obj->buffer.length, sizeof(u64));
+        break;
+    case ACPI_TYPE_PACKAGE:
+        if (depth >= ACPI_CALL_MAX_DEPTH)
+            break;
+
+        // the element headers come first, their data follows
+        hdr->length = obj->package.count;
+        hdr->value = *data;
+        elements = (struct acpi_call_object *) (out + *data);
+        *data += obj->package.count * sizeof(struct acpi_call_object);
+
+        for (i = 0; i < obj->package.count; i++)
+            object_to_ioctl(out, &obj->package.elements[i], &elements[i], data, depth + 1);
+        break;
+    default:
+        break;
+    }
+}
+
+/** Copies a call result to the caller's result buffer
+@returns 0 on success, -ENOSPC if the result does not fit
+*/
+static int copy_result_to_user(struct acpi_call_request *req, const union acpi_object *obj)
+{
+    size_t size, data = sizeof(struct acpi_call_object);
+    void __user *result = (void __user *) (uintptr_t) req->result;
+    u8 *out;
+    int ret = 0;
+
+    if (!obj) {
+        req->result_size = 0;
+        return 0;
+    }
+
+    size = sizeof(struct acpi_call_object) + ioctl_data_size(obj, 0);
+    if (size > ACPI_CALL_RESULT_MAX || size > req->result_size) {
+        req->result_size = size;
+        return -ENOSPC;
+    }
+
+    out = kzalloc(size, GFP_KERNEL);
+    if (!out)
+        return -ENOMEM;
+
+    object_to_ioctl(out, obj, (struct acpi_call_object *) out, &data, 0);
+
+    if (copy_to_user(result, out, size))
+        ret = -EFAULT;
+    req->result_size = size;
+
+    kfree(out);
+    return ret;
+}
+
+/** /dev/acpi_call ioctl callback, see acpi_call.h
+*/
+static long acpi_call_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct acpi_buffer buffer = { ACPI_ALLOCATE_BUFFER, NULL };
+    void __user *user_req = (void __user *) arg;
+    struct acpi_call_request req;
+    union acpi_object *argv = NULL;
+    u8 *args = NULL;
+    acpi_status status;
+    u32 i, budget;
+    int ret = 0;
+
+    if (cmd != ACPI_CALL_IOC_CALL)
+        return -ENOTTY;
+
+    if (copy_from_user(&req, user_req, sizeof(req)))
+        return -EFAULT;
+    req.path[ACPI_CALL_PATH_MAX - 1] = '\0';
+
+    if (req.argc > MAX_ACPI_ARGS || req.args_size > ACPI_CALL_ARGS_MAX ||
+        req.argc * sizeof(struct acpi_call_object) > req.args_size)
+        return -EINVAL;
+
+    if (req.args_size) {
+        args = memdup_user((void __user *) (uintptr_t) req.args, req.args_size);
+        if (IS_ERR(args))
+            return PTR_ERR(args);
+    }
+
+    argv = kcalloc(max_t(u32, req.argc, 1), sizeof(union acpi_object), GFP_KERNEL);
+    if (!argv) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    // never more objects than the argument buffer can hold
+    budget = req.args_size / sizeof(struct acpi_call_object) - req.argc;
+    for (i = 0; i < req.argc; i++) {
+        ret = object_from_ioctl(args, req.args_size, (struct acpi_call_object *) args + i, &argv[i], 0, &budget);
+        if (ret)
+            goto out;
+    }
+
+    status = evaluate_method(req.path, req.argc, argv, &buffer);
+    req.status = status;
+
+    if (ACPI_SUCCESS(status))
+        ret = copy_result_to_user(&req, buffer.pointer);
+    else
+        req.result_size = 0;
+    kfree(buffer.pointer);
+
+    if ((!ret || ret == -ENOSPC) && copy_to_user(user_req, &req, sizeof(req)))
+        ret = -EFAULT;
+
+out:
+    if (argv) {
+        for (i = 0; i < req.argc; i++)
+            free_ioctl_object(&argv[i]);
+        kfree(argv);
+    }
+    kfree(args);
+
+    return ret;
+}
+
+static const struct file_operations acpi_call_fops = {
+        .owner          = THIS_MODULE,
+        .unlocked_ioctl = acpi_call_ioctl,
+#ifdef CONFIG_COMPAT
+        // the request layout is the same for 32 bit callers
+        .compat_ioctl   = acpi_call_ioctl,
+#endif
+};
+
+static struct miscdevice acpi_call_device = {
+        .minor  = MISC_DYNAMIC_MINOR,
+        .name   = "acpi_call",
+        .fops   = &acpi_call_fops,
+        .mode   = 0600,
+};
+
+static bool acpi_call_device_registered;
+
 /** module initialization function */
 static int __init init_acpi_call(void)
 {
@@ -357,7 +2081,10 @@ static int __init init_acpi_call(void)
     struct proc_dir_entry *acpi_entry = create_proc_entry("call", 0660, acpi_root_dir);
 #endif
 
-    strcpy(result_buffer, "not called");
+    result_printf(&last_result, "not called");
+#ifndef HAVE_PROC_CREATE
+    init_call_context(&legacy_context);
+#endif
 
     if (acpi_entry == NULL) {
       printk(KERN_ERR "acpi_call: Couldn't create proc entry\n");
@@ -369,6 +2096,26 @@ static int __init init_acpi_call(void)
     acpi_entry->read_proc = acpi_proc_read;
 #endif
 
+    init_handle_cache();
+
+    // the binary interface is optional, /proc/acpi/call works without it
+    if (misc_register(&acpi_call_device))
+        printk(KERN_ERR "acpi_call: Couldn't register /dev/acpi_call\n");
+    else
+        acpi_call_device_registered = true;
+
+    // statistics are optional, the module works without debugfs
+    debugfs_dir = debugfs_create_dir("acpi_call", NULL);
+    if (!IS_ERR_OR_NULL(debugfs_dir)) {
+        debugfs_create_file("latency", 0444, debugfs_dir, NULL, &latency_fops);
+        debugfs_create_u64("handle_cache_hits", 0444, debugfs_dir, &handle_cache_hits);
+        debugfs_create_u64("handle_cache_misses", 0444, debugfs_dir, &handle_cache_misses);
+        debugfs_create_u64("handle_cache_flushes", 0444, debugfs_dir, &handle_cache_flushes);
+        debugfs_create_file("result_cache", 0444, debugfs_dir, NULL, &result_cache_fops);
+        debugfs_create_u64("result_cache_hits", 0444, debugfs_dir, &result_cache_hits);
+        debugfs_create_u64("result_cache_misses", 0444, debugfs_dir, &result_cache_misses);
+    }
+
 #ifdef DEBUG
     printk(KERN_INFO "acpi_call: Module loaded successfully\n");
 #endif
@@ -379,6 +2126,16 @@ static int __init init_acpi_call(void)
 static void __exit unload_acpi_call(void)
 {
     remove_proc_entry("call", acpi_root_dir);
+    if (acpi_call_device_registered)
+        misc_deregister(&acpi_call_device);
+    debugfs_remove_recursive(debugfs_dir);
+    exit_handle_cache();
+    flush_result_cache();
+
+#ifndef HAVE_PROC_CREATE
+    release_call_context(&legacy_context);
+#endif
+    result_free(&last_result);
 
 #ifdef DEBUG
     printk(KERN_INFO "acpi_call: Module unloaded successfully\n");
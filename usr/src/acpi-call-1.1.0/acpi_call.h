@@ -0,0 +1,69 @@
+/* Copyright (c) 2010: Michal Kottman */
+
+/* Binary interface of /dev/acpi_call, usable from kernel and user space.
+
+A call is made with the ACPI_CALL_IOC_CALL ioctl. Arguments and results are
+trees of struct acpi_call_object stored in flat buffers. Strings, buffers and
+package elements are referenced by their byte offset from the start of the
+buffer holding the object, so the buffers can be built and read without any
+pointer fixups:
+
+    args:   argc objects at offset 0, followed by the data they reference
+    result: the returned object at offset 0, followed by the data it references
+
+Offsets of package elements must be 8 byte aligned. Elements may be shared between
+packages, but the arguments may not expand to more objects than the argument
+buffer holds. Strings in results are NUL terminated, the terminator is not
+included in length.
+*/
+
+#ifndef _ACPI_CALL_H
+#define _ACPI_CALL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define ACPI_CALL_PATH_MAX 256
+#define ACPI_CALL_ARGS_MAX (64 * 1024)
+#define ACPI_CALL_RESULT_MAX (64 * 1024)
+#define ACPI_CALL_MAX_DEPTH 8
+
+/* same values as ACPI_TYPE_*, results may carry other ACPI types with length 0 */
+#define ACPI_CALL_TYPE_INTEGER 1
+#define ACPI_CALL_TYPE_STRING 2
+#define ACPI_CALL_TYPE_BUFFER 3
+#define ACPI_CALL_TYPE_PACKAGE 4
+
+struct acpi_call_object {
+    __u32 type;
+    __u32 length;   /* bytes of a string or buffer, elements of a package */
+    __u64 value;    /* value of an integer, offset of the data otherwise */
+};
+
+/** Request of ACPI_CALL_IOC_CALL
+@path           Fully qualified method path, e.g. "\_SB.PCI0.PEG0.PEGP._STA"
+@args           User pointer to the argument buffer
+@args_size      Size of the argument buffer
+@argc           Number of arguments at the start of the argument buffer
+@result         User pointer to the result buffer
+@result_size    In: size of the result buffer. Out: size of the result,
+                0 if the method returned nothing
+@status         Out: ACPI status of the call
+
+The ioctl fails with ENOSPC if the result does not fit. The method has been
+executed in that case and result_size tells the required size.
+*/
+struct acpi_call_request {
+    char path[ACPI_CALL_PATH_MAX];
+    __u64 args;
+    __u32 args_size;
+    __u32 argc;
+    __u64 result;
+    __u32 result_size;
+    __u32 status;
+};
+
+#define ACPI_CALL_IOC_MAGIC 0xAC
+#define ACPI_CALL_IOC_CALL _IOWR(ACPI_CALL_IOC_MAGIC, 1, struct acpi_call_request)
+
+#endif
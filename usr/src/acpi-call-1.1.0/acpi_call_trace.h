@@ -0,0 +1,56 @@
+/* Copyright (c) 2010: Michal Kottman */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM acpi_call
+
+#if !defined(_ACPI_CALL_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _ACPI_CALL_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/version.h>
+
+/** One ACPI method evaluation
+arg0 is the first argument if it is an integer, result_type the ACPI type of the
+returned object (0 if there is none) and status the ACPI status of the call
+*/
+TRACE_EVENT(acpi_call_eval,
+
+    TP_PROTO(const char *method, int argc, u64 arg0, u32 status, u32 result_type, u64 duration_ns),
+
+    TP_ARGS(method, argc, arg0, status, result_type, duration_ns),
+
+    TP_STRUCT__entry(
+        __string(method, method)
+        __field(int, argc)
+        __field(u64, arg0)
+        __field(u32, status)
+        __field(u32, result_type)
+        __field(u64, duration_ns)
+    ),
+
+    TP_fast_assign(
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0)
+        __assign_str(method);
+#else
+        __assign_str(method, method);
+#endif
+        __entry->argc = argc;
+        __entry->arg0 = arg0;
+        __entry->status = status;
+        __entry->result_type = result_type;
+        __entry->duration_ns = duration_ns;
+    ),
+
+    TP_printk("method=%s argc=%d arg0=%#llx status=%#x result_type=%u duration_ns=%llu",
+        __get_str(method), __entry->argc, (unsigned long long) __entry->arg0,
+        __entry->status, __entry->result_type, (unsigned long long) __entry->duration_ns)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE acpi_call_trace
+
+#include <trace/define_trace.h>
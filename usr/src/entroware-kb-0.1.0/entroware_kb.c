@@ -28,6 +28,9 @@
 #include <linux/platform_device.h>
 #include <linux/input.h>
 
+#define CREATE_TRACE_POINTS
+#include "entroware_kb_trace.h"
+
 MODULE_AUTHOR("Entroware <dev@entroware.com>");
 MODULE_DESCRIPTION("Entroware Keyboard Driver");
 MODULE_LICENSE("GPL");
@@ -36,7 +39,11 @@ MODULE_VERSION("0.1.0");
 // Sysfs Interface for the keyboard state (ON / OFF)
 static ssize_t show_state_fs(struct device *child, struct device_attribute *attr, char *buffer)
 {
-    return sprintf(buffer, "%d\n", keyboard.state);
+    struct kb_state kb;
+
+    kb_snapshot(&kb);
+
+    return sprintf(buffer, "%d\n", kb.state);
 }
 
 static ssize_t set_state_fs(struct device *child, struct device_attribute *attr, const char *buffer, size_t size)
@@ -51,7 +58,9 @@ static ssize_t set_state_fs(struct device *child, struct device_attribute *attr,
 
     val = clamp_t(u8, val, 0, 1);
 
+    mutex_lock(&kb_lock);
     set_kb_state(val);
+    mutex_unlock(&kb_lock);
 
     return ret ? : size;
 }
@@ -59,7 +68,11 @@ static ssize_t set_state_fs(struct device *child, struct device_attribute *attr,
 // Sysfs Interface for the colour of the left side (Colour as hexvalue)
 static ssize_t show_colour_left_fs(struct device *child, struct device_attribute *attr, char *buffer)
 {
-    return sprintf(buffer, "%06x\n", keyboard.colour.left);
+    struct kb_state kb;
+
+    kb_snapshot(&kb);
+
+    return sprintf(buffer, "%06x\n", kb.colour.left);
 }
 
 static ssize_t set_colour_left_fs(struct device *child, struct device_attribute *attr, const char *buffer, size_t size)
@@ -70,7 +83,11 @@ static ssize_t set_colour_left_fs(struct device *child, struct device_attribute
 // Sysfs Interface for the colour of the centre (Colour as hexvalue)
 static ssize_t show_colour_centre_fs(struct device *child, struct device_attribute *attr, char *buffer)
 {
-    return sprintf(buffer, "%06x\n", keyboard.colour.centre);
+    struct kb_state kb;
+
+    kb_snapshot(&kb);
+
+    return sprintf(buffer, "%06x\n", kb.colour.centre);
 }
 
 static ssize_t set_colour_centre_fs(struct device *child, struct device_attribute *attr, const char *buffer, size_t size)
@@ -81,7 +98,11 @@ static ssize_t set_colour_centre_fs(struct device *child, struct device_attribut
 // Sysfs Interface for the colour of the right side (Colour as hexvalue)
 static ssize_t show_colour_right_fs(struct device *child, struct device_attribute *attr, char *buffer)
 {
-    return sprintf(buffer, "%06x\n", keyboard.colour.right);
+    struct kb_state kb;
+
+    kb_snapshot(&kb);
+
+    return sprintf(buffer, "%06x\n", kb.colour.right);
 }
 
 static ssize_t set_colour_right_fs(struct device *child, struct device_attribute *attr, const char *buffer, size_t size)
@@ -92,7 +113,11 @@ static ssize_t set_colour_right_fs(struct device *child, struct device_attribute
 // Sysfs Interface for the colour of the extra region (Colour as hexvalue)
 static ssize_t show_colour_extra_fs(struct device *child, struct device_attribute *attr, char *buffer)
 {
-    return sprintf(buffer, "%06x\n", keyboard.colour.extra);
+    struct kb_state kb;
+
+    kb_snapshot(&kb);
+
+    return sprintf(buffer, "%06x\n", kb.colour.extra);
 }
 
 static ssize_t set_colour_extra_fs(struct device *child, struct device_attribute *attr, const char *buffer, size_t size)
@@ -103,7 +128,11 @@ static ssize_t set_colour_extra_fs(struct device *child, struct device_attribute
 // Sysfs Interface for the keyboard brightness (unsigned int)
 static ssize_t show_brightness_fs(struct device *child, struct device_attribute *attr, char *buffer)
 {
-    return sprintf(buffer, "%d\n", keyboard.brightness);
+    struct kb_state kb;
+
+    kb_snapshot(&kb);
+
+    return sprintf(buffer, "%d\n", kb.brightness);
 }
 
 static ssize_t set_brightness_fs(struct device *child, struct device_attribute *attr, const char *buffer, size_t size)
@@ -116,8 +145,10 @@ static ssize_t set_brightness_fs(struct device *child, struct device_attribute *
         return ret;
     }
 
-    val = clamp_t(u8, val, BRIGHTNESS_MIN, BRIGHTNESS_MAX);
+    val = clamp_t(unsigned int, val, BRIGHTNESS_MIN, kb_caps.brightness_max);
+    mutex_lock(&kb_lock);
     set_brightness(val);
+    mutex_unlock(&kb_lock);
 
     return ret ? : size;
 }
@@ -125,7 +156,11 @@ static ssize_t set_brightness_fs(struct device *child, struct device_attribute *
 // Sysfs Interface for the keyboard kbd_colour
 static ssize_t show_kbd_colour_fs(struct device *child, struct device_attribute *attr, char *buffer)
 {
-    return sprintf(buffer, "%d\n", keyboard.kbd_colour);
+    struct kb_state kb;
+
+    kb_snapshot(&kb);
+
+    return sprintf(buffer, "%d\n", kb.kbd_colour);
 }
 
 static ssize_t set_kbd_colour_fs(struct device *child, struct device_attribute *attr, const char *buffer, size_t size)
@@ -139,7 +174,9 @@ static ssize_t set_kbd_colour_fs(struct device *child, struct device_attribute *
     }
 
     val = clamp_t(u8, val, 0, ARRAY_SIZE(kbd_colours) - 1);
+    mutex_lock(&kb_lock);
     set_kbd_colour(val);
+    mutex_unlock(&kb_lock);
 
     return ret ? : size;
 }
@@ -147,139 +184,388 @@ static ssize_t set_kbd_colour_fs(struct device *child, struct device_attribute *
 // Sysfs Interface for if the keyboard has extra region
 static ssize_t show_hasextra_fs(struct device *child, struct device_attribute *attr, char *buffer)
 {
-    return sprintf(buffer, "%d\n", keyboard.has_extra);
+    struct kb_state kb;
+
+    kb_snapshot(&kb);
+
+    return sprintf(buffer, "%d\n", kb.has_extra);
 }
 
-static int __init entroware_kb_init(void)
+// Sysfs Interface for the lighting effect (name of the effect, active one in brackets)
+static ssize_t show_effect_fs(struct device *child, struct device_attribute *attr, char *buffer)
 {
-    int err;
-	const char *sys_vendor;
-
-    sys_vendor = dmi_get_system_info(DMI_SYS_VENDOR);
+    ssize_t len = 0;
+    int i;
 
-    if (!wmi_has_guid(CLEVO_EVENT_GUID)) 
+    for (i = 0; i < EFFECT_COUNT; i++)
     {
-        ENTROWARE_ERROR("No known WMI event notification GUID found\n");
-        return -ENODEV;
+        len += sprintf(buffer + len, i == kb_effect.effect ? "[%s] " : "%s ", kb_effect_names[i]);
     }
 
-    if (!wmi_has_guid(CLEVO_GET_GUID)) 
+    buffer[len - 1] = '\n';
+
+    return len;
+}
+
+static ssize_t set_effect_fs(struct device *child, struct device_attribute *attr, const char *buffer, size_t size)
+{
+    int effect = sysfs_match_string(kb_effect_names, buffer);
+
+    if (effect < 0)
     {
-        ENTROWARE_ERROR("No known WMI control method GUID found\n");
-        return -ENODEV;
+        return effect;
     }
 
-/*
-    if (strcmp(sys_vendor, "Entroware"))
+    if (!(kb_caps.effects & BIT(effect)))
     {
-        ENTROWARE_INFO("'%s %s (%s)' Detected\n", dmi_get_system_info(DMI_SYS_VENDOR),
-            dmi_get_system_info(DMI_PRODUCT_NAME),
-            dmi_get_system_info(DMI_PRODUCT_VERSION));
+        return -EOPNOTSUPP;
     }
-    else
+
+    mutex_lock(&kb_lock);
+
+    if (effect != kb_effect.effect)
     {
-        return -EPERM;
+        // Restore the static lighting before another effect takes over
+        kb_effect.effect = EFFECT_STATIC;
+        kb_effect_update();
     }
-*/
-    
 
-    entroware_platform_device = platform_create_bundle(&entroware_platform_driver, entroware_wmi_probe, NULL, 0, NULL, 0);
-    if (unlikely(IS_ERR(entroware_platform_device)))
+    kb_effect.effect = effect;
+    kb_effect_update();
+
+    mutex_unlock(&kb_lock);
+
+    return size;
+}
+
+// Sysfs Interface for the lighting effect speed (EFFECT_SPEED_MIN - EFFECT_SPEED_MAX)
+static ssize_t show_effect_speed_fs(struct device *child, struct device_attribute *attr, char *buffer)
+{
+    return sprintf(buffer, "%d\n", kb_effect.speed);
+}
+
+static ssize_t set_effect_speed_fs(struct device *child, struct device_attribute *attr, const char *buffer, size_t size)
+{
+    unsigned int val;
+    int ret = kstrtouint(buffer, 0, &val);
+
+    if (ret)
     {
-        ENTROWARE_ERROR("Can not init Platform driver");
-        return PTR_ERR(entroware_platform_device);
+        return ret;
     }
 
-    err = entroware_input_init();
-    if (unlikely(err))
+    mutex_lock(&kb_lock);
+    kb_effect.speed = clamp_t(unsigned int, val, EFFECT_SPEED_MIN, EFFECT_SPEED_MAX);
+    mutex_unlock(&kb_lock);
+
+    return size;
+}
+
+// Sysfs Interface for the detected keyboard capabilities
+// Format: "regions=<name,...> brightness_max=<n> effects=<name,...> source=<dmi|probe|param>"
+static ssize_t show_capabilities_fs(struct device *child, struct device_attribute *attr, char *buffer)
+{
+    static const char * const regions[] = { "left", "centre", "right", "extra" };
+    const char *sep = "";
+    ssize_t len;
+    int i;
+
+    len = sprintf(buffer, "regions=");
+    for (i = 0; i < ARRAY_SIZE(regions); i++)
     {
-        ENTROWARE_ERROR("Could not register input device\n");
-    }	
+        if (kb_caps.regions & BIT(i))
+        {
+            len += sprintf(buffer + len, "%s%s", sep, regions[i]);
+            sep = ",";
+        }
+    }
+
+    len += sprintf(buffer + len, " brightness_max=%d effects=", kb_caps.brightness_max);
 
-    if (device_create_file(&entroware_platform_device->dev, &dev_attr_state) != 0)
+    sep = "";
+    for (i = 0; i < EFFECT_COUNT; i++)
     {
-        ENTROWARE_ERROR("Sysfs attribute creation failed for state\n");
+        if (kb_caps.effects & BIT(i))
+        {
+            len += sprintf(buffer + len, "%s%s", sep, kb_effect_names[i]);
+            sep = ",";
+        }
     }
 
-    if (device_create_file(&entroware_platform_device->dev, &dev_attr_colour_left) != 0)
+    len += sprintf(buffer + len, " source=%s\n", kb_caps_source);
+
+    return len;
+}
+
+// Sysfs Interface for a binary snapshot of the whole keyboard state (struct kb_snapshot_data)
+static ssize_t show_snapshot_fs(struct file *file, struct kobject *kobj, struct bin_attribute *attr, char *buffer, loff_t off, size_t count)
+{
+    struct kb_snapshot_data data = { .version = KB_SNAPSHOT_VERSION };
+    struct kb_state kb;
+
+    kb_snapshot(&kb);
+
+    if (kb.has_extra == 1)
     {
-        ENTROWARE_ERROR("Sysfs attribute creation failed for colour left\n");
+        data.caps |= KB_CAP_EXTRA;
     }
 
-    if (device_create_file(&entroware_platform_device->dev, &dev_attr_colour_centre) != 0)
+    if (IS_REACHABLE(CONFIG_LEDS_CLASS_MULTICOLOR))
     {
-        ENTROWARE_ERROR("Sysfs attribute creation failed for colour centre\n");
+        data.caps |= KB_CAP_LEDS;
     }
 
-    if (device_create_file(&entroware_platform_device->dev, &dev_attr_colour_right) != 0)
+    data.state = kb.state;
+    data.brightness = kb.brightness;
+    data.kbd_colour = kb.kbd_colour;
+
+    data.colour_left = kb.colour.left;
+    data.colour_centre = kb.colour.centre;
+    data.colour_right = kb.colour.right;
+    data.colour_extra = kb.colour.extra;
+
+    return memory_read_from_buffer(buffer, count, &off, &data, sizeof(data));
+}
+
+// Sysfs Interface for all regions, brightness and state
+// Format: "<left> <centre> <right> <extra> <brightness> <state> [nowait]", colours as hexvalues.
+// With nowait the write returns once the commands are queued, firmware errors are not reported
+static ssize_t show_colours_fs(struct device *child, struct device_attribute *attr, char *buffer)
+{
+    struct kb_state kb;
+
+    kb_snapshot(&kb);
+
+    return sprintf(buffer, "%06x %06x %06x %06x %d %d\n",
+        kb.colour.left, kb.colour.centre, kb.colour.right, kb.colour.extra,
+        kb.brightness, kb.state);
+}
+
+static ssize_t set_colours_fs(struct device *child, struct device_attribute *attr, const char *buffer, size_t size)
+{
+    struct kb_lighting lighting;
+    unsigned int brightness, state;
+    char flag[8];
+    bool nowait;
+    int ret;
+
+    ret = sscanf(buffer, "%x %x %x %x %u %u %7s", &lighting.colour.left, &lighting.colour.centre,
+        &lighting.colour.right, &lighting.colour.extra, &brightness, &state, flag);
+    if (ret < 6 || (ret == 7 && strcmp(flag, "nowait")))
     {
-        ENTROWARE_ERROR("Sysfs attribute creation failed for colour right\n");
+        return -EINVAL;
     }
+    nowait = ret == 7;
 
-    if(set_colour(REGION_EXTRA, KB_COLOUR_DEFAULT) == 0)
+    // Validate every field before anything is sent to the firmware
+    if (lighting.colour.left > COLOUR_MAX || lighting.colour.centre > COLOUR_MAX ||
+        lighting.colour.right > COLOUR_MAX || lighting.colour.extra > COLOUR_MAX ||
+        brightness > kb_caps.brightness_max || state > 1)
     {
-        ENTROWARE_DEBUG("Keyboard does not support EXTRA Colour");
-        keyboard.has_extra = 0;
+        return -EINVAL;
     }
-    else
+
+    lighting.brightness = brightness;
+    lighting.state = state;
+
+    mutex_lock(&kb_lock);
+    kb_queue.nowait = nowait;
+    ret = set_kb_lighting(&lighting);
+    kb_queue.nowait = false;
+    mutex_unlock(&kb_lock);
+
+    return ret ? : size;
+}
+
+static ssize_t show_palette_fs(struct device *child, struct device_attribute *attr, char *buffer)
+{
+    const struct kb_profile *profile;
+    ssize_t len = 0;
+    unsigned int i;
+
+    mutex_lock(&kb_lock);
+
+    for (i = 0; i < kb_palette.count; i++)
     {
-        keyboard.has_extra = 1;
-        if (device_create_file(&entroware_platform_device->dev, &dev_attr_colour_extra) != 0)
-        {
-            ENTROWARE_ERROR("Sysfs attribute creation failed for colour extra\n");
-        }
+        profile = &kb_palette.profiles[i];
 
-        set_colour(REGION_EXTRA, param_colour_extra);
+        len += scnprintf(buffer + len, PAGE_SIZE - len, "%s %06x %06x %06x %06x %d\n", profile->name,
+            profile->lighting.colour.left, profile->lighting.colour.centre,
+            profile->lighting.colour.right, profile->lighting.colour.extra,
+            profile->lighting.brightness);
     }
 
-    if (device_create_file(&entroware_platform_device->dev, &dev_attr_extra) != 0)
+    mutex_unlock(&kb_lock);
+
+    return len;
+}
+
+// Replaces the whole palette, an empty write returns the hotkey to the kbd_colour cycle
+static ssize_t set_palette_fs(struct device *child, struct device_attribute *attr, const char *buffer, size_t size)
+{
+    struct kb_profile *profiles, *profile;
+    unsigned int count = 0, brightness, i;
+    char *input, *cursor, *line;
+    int ret = 0;
+
+    input = kstrndup(buffer, size, GFP_KERNEL);
+    profiles = kcalloc(KB_PALETTE_MAX, sizeof(*profiles), GFP_KERNEL);
+
+    if (!input || !profiles)
     {
-        ENTROWARE_ERROR("Sysfs attribute creation failed for extra information flag\n");
+        ret = -ENOMEM;
+        goto out;
     }
 
-    if (device_create_file(&entroware_platform_device->dev, &dev_attr_kbd_colour) != 0)
+    cursor = input;
+
+    // Parse and validate every profile before the palette is touched
+    while ((line = strsep(&cursor, "\n")) != NULL)
     {
-        ENTROWARE_ERROR("Sysfs attribute creation failed for kbd_colour\n");
+        line = strim(line);
+        if (*line == '\0')
+        {
+            continue;
+        }
+
+        if (count == KB_PALETTE_MAX)
+        {
+            ret = -E2BIG;
+            goto out;
+        }
+
+        profile = &profiles[count];
+
+        if (sscanf(line, "%15s %x %x %x %x %u", profile->name, &profile->lighting.colour.left,
+            &profile->lighting.colour.centre, &profile->lighting.colour.right,
+            &profile->lighting.colour.extra, &brightness) != 6)
+        {
+            ret = -EINVAL;
+            goto out;
+        }
+
+        if (profile->lighting.colour.left > COLOUR_MAX || profile->lighting.colour.centre > COLOUR_MAX ||
+            profile->lighting.colour.right > COLOUR_MAX || profile->lighting.colour.extra > COLOUR_MAX ||
+            brightness > kb_caps.brightness_max)
+        {
+            ret = -EINVAL;
+            goto out;
+        }
+
+        for (i = 0; i < count; i++)
+        {
+            if (!strcmp(profiles[i].name, profile->name))
+            {
+                ret = -EINVAL;
+                goto out;
+            }
+        }
+
+        profile->lighting.brightness = brightness;
+        count++;
     }
 
-    if (device_create_file(&entroware_platform_device->dev, &dev_attr_brightness) != 0)
+    mutex_lock(&kb_lock);
+    memcpy(kb_palette.profiles, profiles, count * sizeof(*profiles));
+    kb_palette.count = count;
+    kb_palette.active = -1;
+    mutex_unlock(&kb_lock);
+
+    kb_sysfs_notify("palette");
+    kb_sysfs_notify("profile");
+
+out:
+    kfree(profiles);
+    kfree(input);
+
+    return ret ? : size;
+}
+
+static ssize_t show_profile_fs(struct device *child, struct device_attribute *attr, char *buffer)
+{
+    ssize_t len;
+
+    mutex_lock(&kb_lock);
+
+    if (kb_palette.active < 0)
     {
-        ENTROWARE_ERROR("Sysfs attribute creation failed for brightness\n");
+        len = sprintf(buffer, "\n");
+    }
+    else
+    {
+        len = sprintf(buffer, "%s\n", kb_palette.profiles[kb_palette.active].name);
     }
 
-    keyboard.colour.left = param_colour_left;
-    keyboard.colour.centre = param_colour_centre;
-    keyboard.colour.right = param_colour_right;
-    keyboard.colour.extra = param_colour_extra;
+    mutex_unlock(&kb_lock);
+
+    return len;
+}
 
-    set_colour(REGION_LEFT,      param_colour_left);
-    set_colour(REGION_CENTRE,    param_colour_centre);
-    set_colour(REGION_RIGHT,     param_colour_right);
+static ssize_t set_profile_fs(struct device *child, struct device_attribute *attr, const char *buffer, size_t size)
+{
+    int index, ret;
 
-    set_kbd_colour(param_kbd_colour);
-    set_brightness(param_brightness);
-    set_kb_state(param_state);
+    mutex_lock(&kb_lock);
 
-    return 0;
+    index = kb_profile_find(buffer);
+    if (index < 0)
+    {
+        ret = index;
+    }
+    else
+    {
+        ret = kb_profile_apply(index, kb_palette.profiles[index].lighting.brightness, keyboard.state);
+    }
+
+    mutex_unlock(&kb_lock);
+
+    return ret ? : size;
 }
 
-static void __exit entroware_kb_exit(void)
+static int __init entroware_kb_init(void)
 {
-    entroware_input_exit();
+    int err;
 
-    device_remove_file(&entroware_platform_device->dev, &dev_attr_state);
-    device_remove_file(&entroware_platform_device->dev, &dev_attr_colour_left);
-    device_remove_file(&entroware_platform_device->dev, &dev_attr_colour_centre);
-    device_remove_file(&entroware_platform_device->dev, &dev_attr_colour_right);
-    device_remove_file(&entroware_platform_device->dev, &dev_attr_extra);
-    device_remove_file(&entroware_platform_device->dev, &dev_attr_kbd_colour);
-    device_remove_file(&entroware_platform_device->dev, &dev_attr_brightness);
+    kb_init_stats.start = ktime_get();
 
-    if(keyboard.has_extra == 1)
+    if (!wmi_has_guid(CLEVO_EVENT_GUID)) 
+    {
+        ENTROWARE_ERROR("No known WMI event notification GUID found\n");
+        return -ENODEV;
+    }
+
+    if (!wmi_has_guid(CLEVO_GET_GUID)) 
+    {
+        ENTROWARE_ERROR("No known WMI control method GUID found\n");
+        return -ENODEV;
+    }
+
+    kb_caps_init();
+
+    // The driver prefers asynchronous probing and the firmware work is deferred to
+    // kb_init_work, so module load only registers the driver and the device
+    err = platform_driver_register(&entroware_platform_driver);
+    if (unlikely(err))
+    {
+        ENTROWARE_ERROR("Can not register Platform driver");
+        return err;
+    }
+
+    entroware_platform_device = platform_device_register_simple(DRIVER_NAME, -1, NULL, 0);
+    if (unlikely(IS_ERR(entroware_platform_device)))
     {
-        device_remove_file(&entroware_platform_device->dev, &dev_attr_colour_extra);
+        ENTROWARE_ERROR("Can not init Platform driver");
+        platform_driver_unregister(&entroware_platform_driver);
+        return PTR_ERR(entroware_platform_device);
     }
 
+    kb_init_stats.init_ns = ktime_to_ns(ktime_sub(ktime_get(), kb_init_stats.start));
+
+    return 0;
+}
+
+static void __exit entroware_kb_exit(void)
+{
     platform_device_unregister(entroware_platform_device);
 
     platform_driver_unregister(&entroware_platform_driver);
@@ -287,7 +573,7 @@ static void __exit entroware_kb_exit(void)
     ENTROWARE_DEBUG("exit");
 }
 
-static int __init entroware_input_init(void)
+static int entroware_input_init(void)
 {
     int err;
 
@@ -303,7 +589,12 @@ static int __init entroware_input_init(void)
     entroware_input_device->id.bustype = BUS_HOST;
     entroware_input_device->dev.parent = &entroware_platform_device->dev;
 
-    set_bit(EV_KEY, entroware_input_device->evbit);
+    err = sparse_keymap_setup(entroware_input_device, kb_caps.keymap, NULL);
+    if (unlikely(err))
+    {
+        ENTROWARE_ERROR("Error setting up input keymap\n");
+        goto err_free_input_device;
+    }
 
     err = input_register_device(entroware_input_device);
     if (unlikely(err)) 
@@ -316,11 +607,12 @@ static int __init entroware_input_init(void)
 
 err_free_input_device:
     input_free_device(entroware_input_device);
+    entroware_input_device = NULL;
 
     return err;
 }
 
-static void __exit entroware_input_exit(void)
+static void entroware_input_exit(void)
 {
     if (unlikely(!entroware_input_device))
     {
@@ -335,7 +627,28 @@ static void __exit entroware_input_exit(void)
 
 static int entroware_wmi_probe(struct platform_device *dev)
 {
+    ktime_t start = ktime_get();
     int status;
+    int err;
+
+    // May run before entroware_kb_init() has stored the device
+    entroware_platform_device = dev;
+
+    mutex_lock(&kb_lock);
+    kb_removed = false;
+    mutex_unlock(&kb_lock);
+
+    spin_lock(&kb_queue.lock);
+    kb_queue.draining = false;
+    spin_unlock(&kb_queue.lock);
+
+    entroware_debugfs_init();
+
+    err = entroware_input_init();
+    if (unlikely(err))
+    {
+        ENTROWARE_ERROR("Could not register input device\n");
+    }	
 
     status = wmi_install_notify_handler(CLEVO_EVENT_GUID, entroware_wmi_notify, NULL);
     ENTROWARE_DEBUG("clevo_xsm_wmi_probe status: (%0#6x)", status);
@@ -343,227 +656,1520 @@ static int entroware_wmi_probe(struct platform_device *dev)
     if (unlikely(ACPI_FAILURE(status))) 
     {
     	ENTROWARE_ERROR("Could not register WMI notify handler (%0#6x)\n", status);
+        entroware_input_exit();
+        debugfs_remove_recursive(entroware_debugfs_dir);
     	return -EIO;
     }
 
-    entroware_evaluate_method(GET_AP, 0, NULL);
+    if (device_create_file(&dev->dev, &dev_attr_state) != 0)
+    {
+        ENTROWARE_ERROR("Sysfs attribute creation failed for state\n");
+    }
 
-    return 0;
-}
+    if (device_create_file(&dev->dev, &dev_attr_colour_left) != 0)
+    {
+        ENTROWARE_ERROR("Sysfs attribute creation failed for colour left\n");
+    }
 
-static int entroware_wmi_remove(struct platform_device *dev)
-{
-    wmi_remove_notify_handler(CLEVO_EVENT_GUID);
-    return 0;
-}
+    if (device_create_file(&dev->dev, &dev_attr_colour_centre) != 0)
+    {
+        ENTROWARE_ERROR("Sysfs attribute creation failed for colour centre\n");
+    }
 
-static int entroware_wmi_resume(struct platform_device *dev)
-{
-    entroware_evaluate_method(GET_AP, 0, NULL);
+    if (device_create_file(&dev->dev, &dev_attr_colour_right) != 0)
+    {
+        ENTROWARE_ERROR("Sysfs attribute creation failed for colour right\n");
+    }
 
-    return 0;
-}
+    if (device_create_file(&dev->dev, &dev_attr_extra) != 0)
+    {
+        ENTROWARE_ERROR("Sysfs attribute creation failed for extra information flag\n");
+    }
 
-static void entroware_wmi_notify(u32 value, void *context)
-{
-    u32 event;
+    if (device_create_file(&dev->dev, &dev_attr_capabilities) != 0)
+    {
+        ENTROWARE_ERROR("Sysfs attribute creation failed for capabilities\n");
+    }
 
-    entroware_evaluate_method(GET_EVENT, 0, &event);
-	  ENTROWARE_DEBUG("WMI event (%0#6x)\n", event);
+    if (device_create_file(&dev->dev, &dev_attr_kbd_colour) != 0)
+    {
+        ENTROWARE_ERROR("Sysfs attribute creation failed for kbd_colour\n");
+    }
 
-    switch(event)
+    if (device_create_file(&dev->dev, &dev_attr_brightness) != 0)
     {
-        case WMI_CODE_DECREASE_BACKLIGHT:
-            if(keyboard.brightness == BRIGHTNESS_MIN || (keyboard.brightness - STEP_BRIGHTNESS_STEP) < BRIGHTNESS_MIN)
-            {
-                set_brightness(BRIGHTNESS_MIN);
-            }
-            else
-            {
-                set_brightness(keyboard.brightness - STEP_BRIGHTNESS_STEP);
-            }
+        ENTROWARE_ERROR("Sysfs attribute creation failed for brightness\n");
+    }
 
-            break;
+    if (device_create_file(&dev->dev, &dev_attr_colours) != 0)
+    {
+        ENTROWARE_ERROR("Sysfs attribute creation failed for colours\n");
+    }
+
+    if (device_create_file(&dev->dev, &dev_attr_effect) != 0)
+    {
+        ENTROWARE_ERROR("Sysfs attribute creation failed for effect\n");
+    }
+
+    if (device_create_file(&dev->dev, &dev_attr_effect_speed) != 0)
+    {
+        ENTROWARE_ERROR("Sysfs attribute creation failed for effect speed\n");
+    }
+
+    if (device_create_file(&dev->dev, &dev_attr_palette) != 0)
+    {
+        ENTROWARE_ERROR("Sysfs attribute creation failed for palette\n");
+    }
+
+    if (device_create_file(&dev->dev, &dev_attr_profile) != 0)
+    {
+        ENTROWARE_ERROR("Sysfs attribute creation failed for profile\n");
+    }
+
+    if (device_create_bin_file(&dev->dev, &bin_attr_snapshot) != 0)
+    {
+        ENTROWARE_ERROR("Sysfs attribute creation failed for snapshot\n");
+    }
+
+    if (misc_register(&kb_stream_device) != 0)
+    {
+        ENTROWARE_ERROR("Could not register the frame stream device\n");
+    }
+    else
+    {
+        kb_stream_registered = true;
+    }
+
+    schedule_work(&kb_init_work);
+
+    kb_init_stats.probe_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+    return 0;
+}
+
+static int entroware_wmi_remove(struct platform_device *dev)
+{
+    wmi_remove_notify_handler(CLEVO_EVENT_GUID);
+    cancel_work_sync(&kb_init_work);
+
+    device_remove_file(&dev->dev, &dev_attr_state);
+    device_remove_file(&dev->dev, &dev_attr_colour_left);
+    device_remove_file(&dev->dev, &dev_attr_colour_centre);
+    device_remove_file(&dev->dev, &dev_attr_colour_right);
+    device_remove_file(&dev->dev, &dev_attr_extra);
+    device_remove_file(&dev->dev, &dev_attr_capabilities);
+    device_remove_file(&dev->dev, &dev_attr_kbd_colour);
+    device_remove_file(&dev->dev, &dev_attr_brightness);
+    device_remove_file(&dev->dev, &dev_attr_colours);
+    device_remove_file(&dev->dev, &dev_attr_effect);
+    device_remove_file(&dev->dev, &dev_attr_effect_speed);
+    device_remove_file(&dev->dev, &dev_attr_palette);
+    device_remove_file(&dev->dev, &dev_attr_profile);
+    device_remove_bin_file(&dev->dev, &bin_attr_snapshot);
+
+    if(keyboard.has_extra == 1)
+    {
+        device_remove_file(&dev->dev, &dev_attr_colour_extra);
+    }
+
+    if (kb_stream_registered)
+    {
+        misc_deregister(&kb_stream_device);
+        kb_stream_registered = false;
+    }
+
+    // Stream files may outlive the device, from here on nothing queues new commands
+    // or restarts the works below
+    mutex_lock(&kb_lock);
+    kb_removed = true;
+    kb_effect.running = false;
+    kb_ramp.active = false;
+    mutex_unlock(&kb_lock);
+
+    cancel_work_sync(&kb_hotkey_work);
+    cancel_work_sync(&kb_resume_work);
+    cancel_delayed_work_sync(&kb_effect_work);
+    cancel_delayed_work_sync(&kb_ramp_work);
+    cancel_delayed_work_sync(&kb_stream_work);
+
+    // No work can touch the LEDs any more
+    entroware_leds_exit();
+
+    // Let the commands still queued reach the firmware, without waiting for the rate limit
+    spin_lock(&kb_queue.lock);
+    kb_queue.draining = true;
+    spin_unlock(&kb_queue.lock);
+
+    flush_delayed_work(&kb_queue_work);
+    cancel_delayed_work_sync(&kb_queue_work);
+
+    entroware_input_exit();
+
+    debugfs_remove_recursive(entroware_debugfs_dir);
+
+    return 0;
+}
+
+// Applies the initial lighting off the module load path. The keyboard struct is set up
+// from the module parameters first, so every setting reaches the firmware only once
+static void kb_init_work_fn(struct work_struct *work)
+{
+    ktime_t start = ktime_get();
+
+    entroware_evaluate_method(GET_AP, 0, NULL);
+
+    mutex_lock(&kb_lock);
+
+    // Only machines missing from the capability table are probed by writing to the extra region.
+    // The probe needs the firmware result, kb_queue.nowait is never set here
+    if (kb_caps_probe_extra && set_colour(REGION_EXTRA, KB_COLOUR_DEFAULT) != 0)
+    {
+        kb_caps.regions |= BIT(SHADOW_EXTRA);
+    }
+
+    if (!(kb_caps.regions & BIT(SHADOW_EXTRA)))
+    {
+        ENTROWARE_DEBUG("Keyboard does not support EXTRA Colour");
+    }
+    else
+    {
+        write_seqlock(&kb_seqlock);
+        keyboard.has_extra = 1;
+        write_sequnlock(&kb_seqlock);
+
+        if (device_create_file(&entroware_platform_device->dev, &dev_attr_colour_extra) != 0)
+        {
+            ENTROWARE_ERROR("Sysfs attribute creation failed for colour extra\n");
+        }
+    }
+
+    write_seqlock(&kb_seqlock);
+    keyboard.colour.left = param_colour_left;
+    keyboard.colour.centre = param_colour_centre;
+    keyboard.colour.right = param_colour_right;
+    keyboard.colour.extra = param_colour_extra;
+    keyboard.kbd_colour = param_kbd_colour;
+    keyboard.brightness = min_t(unsigned int, param_brightness, kb_caps.brightness_max);
+    keyboard.state = param_state;
+    write_sequnlock(&kb_seqlock);
+
+    kb_apply_state();
+
+    entroware_leds_sync_colours();
+
+    mutex_unlock(&kb_lock);
+
+    entroware_leds_init();
+
+    kb_init_stats.lighting_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    kb_init_stats.ready_ns = ktime_to_ns(ktime_sub(ktime_get(), kb_init_stats.start));
+
+    ENTROWARE_DEBUG("init %llu ns, probe %llu ns, initial lighting %llu ns\n",
+        kb_init_stats.init_ns, kb_init_stats.probe_ns, kb_init_stats.lighting_ns);
+}
+
+// Leaves the firmware calls to kb_resume_work so device resume is not held up
+static int entroware_wmi_resume(struct platform_device *dev)
+{
+    kb_resume_stats.resumed = ktime_get();
+    schedule_work(&kb_resume_work);
+
+    return 0;
+}
+
+static void kb_resume_work_fn(struct work_struct *work)
+{
+    ktime_t start = ktime_get();
+
+    entroware_evaluate_method(GET_AP, 0, NULL);
+
+    // The EC may have lost the keyboard settings while suspended
+    mutex_lock(&kb_lock);
+    kb_shadow_invalidate();
+    kb_apply_state();
+    mutex_unlock(&kb_lock);
+
+    kb_resume_stats.last_replay_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    kb_resume_stats.last_latency_ns = ktime_to_ns(ktime_sub(ktime_get(), kb_resume_stats.resumed));
+
+    ENTROWARE_DEBUG("resume replay took %llu ns\n", kb_resume_stats.last_replay_ns);
+}
+
+// Runs in the ACPI notify context, so only fetch the event and leave the work to kb_hotkey_work
+static void entroware_wmi_notify(u32 value, void *context)
+{
+    struct kb_hotkey_event event = { .time = ktime_get() };
+
+    entroware_evaluate_method(GET_EVENT, 0, &event.code);
+    ENTROWARE_DEBUG("WMI event (%0#6x)\n", event.code);
+
+    if (entroware_input_device)
+    {
+        sparse_keymap_report_event(entroware_input_device, event.code, 1, true);
+    }
+
+    if (!kfifo_in_spinlocked(&kb_hotkey_fifo, &event, 1, &kb_hotkey_lock))
+    {
+        kb_hotkey_stats.dropped++;
+    }
+
+    schedule_work(&kb_hotkey_work);
+}
+
+// Picks the capabilities from the DMI table, then applies the module parameter overrides
+static void kb_caps_init(void)
+{
+    const struct dmi_system_id *id = dmi_first_match(kb_dmi_table);
+
+    if (id)
+    {
+        ENTROWARE_INFO("'%s' Detected\n", id->ident);
+
+        kb_caps = *(const struct kb_capabilities *) id->driver_data;
+        kb_caps_source = "dmi";
+    }
+    else
+    {
+        ENTROWARE_INFO("'%s %s (%s)' Detected\n", dmi_get_system_info(DMI_SYS_VENDOR),
+            dmi_get_system_info(DMI_PRODUCT_NAME),
+            dmi_get_system_info(DMI_PRODUCT_VERSION));
+
+        kb_caps = kb_caps_three_regions;
+        kb_caps_source = "probe";
+        kb_caps_probe_extra = true;
+    }
+
+    if (param_regions)
+    {
+        kb_caps.regions = param_regions;
+        kb_caps_source = "param";
+        kb_caps_probe_extra = false;
+    }
+
+    if (param_brightness_max)
+    {
+        kb_caps.brightness_max = min_t(unsigned int, param_brightness_max, BRIGHTNESS_MAX);
+        kb_caps_source = "param";
+    }
+}
+
+static void kb_hotkey_apply(u32 code, struct kb_hotkey_target *target)
+{
+    switch(code)
+    {
+        case WMI_CODE_DECREASE_BACKLIGHT:
+            target->brightness = max_t(int, target->brightness - (int) param_brightness_step, BRIGHTNESS_MIN);
+            break;
+
+        case WMI_CODE_INCREASE_BACKLIGHT:
+            target->brightness = min_t(int, target->brightness + (int) param_brightness_step, kb_caps.brightness_max);
+            break;
+
+        case WMI_CODE_NEXT_COLOUR:
+            // A palette replaces the kbd_colour presets, brightness keys later in the burst adjust the profile's brightness
+            if (kb_palette.count)
+            {
+                target->profile = (target->profile + 1) % kb_palette.count;
+                target->brightness = kb_palette.profiles[target->profile].lighting.brightness;
+                break;
+            }
+
+            if ((target->kbd_colour + 1) > (ARRAY_SIZE(kbd_colours) - 1))
+            {
+                target->kbd_colour = 0;
+            }
+            else
+            {
+                target->kbd_colour++;
+            }
+
+            break;
+
+        case WMI_CODE_TOGGLE_STATE:
+            target->state = target->state == 0 ? 1 : 0;
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Drains the hotkey queue and applies the final state of the whole burst in one update
+static void kb_hotkey_work_fn(struct work_struct *work)
+{
+    struct kb_hotkey_event event;
+    struct kb_hotkey_target target;
+    unsigned int count = 0;
+    ktime_t first = 0;
+    u64 latency;
+
+    mutex_lock(&kb_lock);
+
+    target.brightness = keyboard.brightness;
+    target.state = keyboard.state;
+    target.kbd_colour = keyboard.kbd_colour;
+    target.profile = kb_palette.active;
+
+    while (kfifo_out_spinlocked(&kb_hotkey_fifo, &event, 1, &kb_hotkey_lock))
+    {
+        if (count++ == 0)
+        {
+            first = event.time;
+        }
+
+        kb_hotkey_apply(event.code, &target);
+    }
+
+    if (count == 0)
+    {
+        mutex_unlock(&kb_lock);
+        return;
+    }
+
+    kb_hotkey_stats.events += count;
+    kb_hotkey_stats.coalesced += count - 1;
+
+    if (target.profile != kb_palette.active)
+    {
+        // Colours, brightness and state of the burst go out in one commit
+        kb_profile_apply(target.profile, target.brightness, target.state);
+        entroware_leds_notify_brightness();
+    }
+    else if (target.kbd_colour != keyboard.kbd_colour)
+    {
+        set_kbd_colour(target.kbd_colour);
+    }
+
+    if (target.brightness != keyboard.brightness || target.state != keyboard.state)
+    {
+        set_brightness(target.brightness);
+        set_kb_state(target.state);
+
+        entroware_leds_notify_brightness();
+    }
+
+    mutex_unlock(&kb_lock);
+
+    latency = ktime_to_ns(ktime_sub(ktime_get(), first));
+    kb_hotkey_stats.last_latency_ns = latency;
+    kb_hotkey_stats.max_latency_ns = max(kb_hotkey_stats.max_latency_ns, latency);
+}
+
+// Applies a palette profile with the given brightness and state through set_kb_lighting()
+static int kb_profile_apply(int index, u8 brightness, u8 state)
+{
+    struct kb_lighting lighting = kb_palette.profiles[index].lighting;
+    int ret;
+
+    lockdep_assert_held(&kb_lock);
+
+    ENTROWARE_INFO("profile: %s\n", kb_palette.profiles[index].name);
+
+    lighting.brightness = brightness;
+    lighting.state = state;
+
+    ret = set_kb_lighting(&lighting);
+    if (!ret)
+    {
+        kb_palette.active = index;
+        kb_sysfs_notify("profile");
+    }
+
+    return ret;
+}
+
+static int kb_profile_find(const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < kb_palette.count; i++)
+    {
+        if (sysfs_streq(kb_palette.profiles[i].name, name))
+        {
+            return i;
+        }
+    }
+
+    return -EINVAL;
+}
+
+static void set_kbd_colour(u8 kbd_colour)
+{
+    struct kb_state old = keyboard;
+
+    ENTROWARE_INFO("colour: %s\n", kbd_colours[kbd_colour].name);
+
+    if(!kb_firmware_set(SHADOW_KBD_COLOUR, kbd_colour, kbd_colours[kbd_colour].key))
+    {
+        write_seqlock(&kb_seqlock);
+        keyboard.kbd_colour = kbd_colour;
+        write_sequnlock(&kb_seqlock);
+    }
+
+    kb_paint_regions();
+    kb_notify_changes(&old);
+}
+
+// Paints the regions with the preset of the active kbd_colour, or the custom colours for the default one.
+// Presets do not cover the extra region, it always gets its own colour back after an effect, stream or resume
+static void kb_paint_regions(void)
+{
+    if (keyboard.kbd_colour != KB_KBD_COLOUR_DEFAULT)
+    {
+        set_colour(REGION_LEFT,     kbd_colours[keyboard.kbd_colour].hexvalue);
+        set_colour(REGION_CENTRE,   kbd_colours[keyboard.kbd_colour].hexvalue);
+        set_colour(REGION_RIGHT,    kbd_colours[keyboard.kbd_colour].hexvalue);
+    }
+    else
+    {
+        set_colour(REGION_LEFT,      keyboard.colour.left);
+        set_colour(REGION_CENTRE,    keyboard.colour.centre);
+        set_colour(REGION_RIGHT,     keyboard.colour.right);
+    }
+
+    if(keyboard.has_extra == 1)
+    {
+        set_colour(REGION_EXTRA, keyboard.colour.extra);
+    }
+}
+
+// Sends the whole keyboard state to the firmware as one batch, the shadow drops what it already holds
+static void kb_apply_state(void)
+{
+    kb_firmware_set(SHADOW_KBD_COLOUR, keyboard.kbd_colour, kbd_colours[keyboard.kbd_colour].key);
+    kb_paint_regions();
+    kb_firmware_brightness(keyboard.brightness);
+    kb_firmware_state(keyboard.state);
+}
+
+static void set_brightness(u8 brightness)
+{
+    struct kb_state old = keyboard;
+
+    ENTROWARE_INFO("brightness: %d\n", brightness);
+
+    // The breathing effect drives the firmware brightness itself
+    if (param_brightness_ramp_ms && !(kb_effect.running && kb_effect.effect == EFFECT_BREATHING))
+    {
+        kb_ramp_start(brightness);
+
+        write_seqlock(&kb_seqlock);
+        keyboard.brightness = brightness;
+        write_sequnlock(&kb_seqlock);
+    }
+    else
+    {
+        // Also stops a ramp still heading for an older target
+        if (!kb_firmware_brightness(brightness))
+        {
+            write_seqlock(&kb_seqlock);
+            keyboard.brightness = brightness;
+            write_sequnlock(&kb_seqlock);
+        }
+    }
+
+    kb_notify_changes(&old);
+}
+
+// Fades the firmware brightness to a new target. A new target restarts the ramp
+// from wherever the firmware got to, so the fade never jumps
+static void kb_ramp_start(u8 brightness)
+{
+    if (kb_removed)
+    {
+        return;
+    }
+
+    if (test_bit(SHADOW_BRIGHTNESS, &kb_shadow.valid))
+    {
+        kb_ramp.from = kb_shadow.value[SHADOW_BRIGHTNESS];
+    }
+    else
+    {
+        kb_ramp.from = keyboard.brightness;
+    }
+
+    kb_ramp.to = brightness;
+    kb_ramp.start = ktime_get();
+    kb_ramp.active = true;
+
+    mod_delayed_work(system_wq, &kb_ramp_work, 0);
+}
+
+// Sends one ramp step, never faster than the EC command rate
+static void kb_ramp_work_fn(struct work_struct *work)
+{
+    unsigned int duration = min_t(unsigned int, param_brightness_ramp_ms, BRIGHTNESS_RAMP_MS_MAX);
+    s64 elapsed;
+    u8 brightness;
+
+    mutex_lock(&kb_lock);
+
+    if (!kb_ramp.active)
+    {
+        mutex_unlock(&kb_lock);
+        return;
+    }
+
+    elapsed = ktime_ms_delta(ktime_get(), kb_ramp.start);
+
+    if (elapsed >= duration)
+    {
+        brightness = kb_ramp.to;
+        kb_ramp.active = false;
+    }
+    else
+    {
+        brightness = kb_ramp.from + ((int) kb_ramp.to - kb_ramp.from) * (int) elapsed / (int) duration;
+    }
+
+    kb_queue.nowait = true;
+    kb_firmware_set(SHADOW_BRIGHTNESS, brightness, KEYBOARD_BRIGHTNESS | brightness);
+    kb_queue.nowait = false;
+
+    if (kb_ramp.active)
+    {
+        schedule_delayed_work(&kb_ramp_work, msecs_to_jiffies(EC_COMMAND_INTERVAL_MS));
+    }
+
+    mutex_unlock(&kb_lock);
+}
+
+static void set_kb_state(u8 state)
+{
+    struct kb_state old = keyboard;
+
+    ENTROWARE_INFO("state: %d\n", state);
+
+    if (!kb_firmware_state(state))
+    {
+        write_seqlock(&kb_seqlock);
+        keyboard.state = state;
+        write_sequnlock(&kb_seqlock);
+    }
+
+    kb_notify_changes(&old);
+    kb_effect_update();
+}
+
+// Every writer of the firmware brightness takes over from a running ramp, the ramp
+// itself sends its steps through kb_firmware_set() directly
+static int kb_firmware_brightness(u8 brightness)
+{
+    kb_ramp.active = false;
+
+    return kb_firmware_set(SHADOW_BRIGHTNESS, brightness, KEYBOARD_BRIGHTNESS | brightness);
+}
+
+static int kb_firmware_state(u8 state)
+{
+    u32 cmd = 0xE0000000;
+
+    if(state == 0)
+    {
+        cmd |= 0x003001;
+    }
+    else
+    {
+        cmd |= 0x07F001;
+    }
+
+    return kb_firmware_set(SHADOW_STATE, state, cmd);
+}
+
+// Starts the effect engine, or stops it and restores the static lighting when
+// the effect is static, the keyboard is off or the stream device is in use
+static void kb_effect_update(void)
+{
+    if (kb_effect.effect != EFFECT_STATIC && keyboard.state && !kb_removed &&
+        !atomic_read(&kb_stream.users))
+    {
+        if (!kb_effect.running)
+        {
+            kb_effect.tick = 0;
+            kb_effect.running = true;
+            kb_ramp.active = false;
+        }
+
+        mod_delayed_work(system_wq, &kb_effect_work, 0);
+        return;
+    }
+
+    if (!kb_effect.running)
+    {
+        return;
+    }
+
+    kb_effect.running = false;
+    cancel_delayed_work(&kb_effect_work);
+
+    kb_paint_regions();
+    kb_firmware_brightness(keyboard.brightness);
+}
+
+// Renders one effect frame. Only the firmware is changed, the keyboard settings are left alone
+static void kb_effect_work_fn(struct work_struct *work)
+{
+    unsigned int tick, phase, delay;
+    u64 misses;
+    u32 colour;
+    u8 brightness;
+
+    mutex_lock(&kb_lock);
+
+    if (!kb_effect.running)
+    {
+        mutex_unlock(&kb_lock);
+        return;
+    }
+
+    tick = kb_effect.tick++;
+    misses = kb_shadow.misses;
+
+    // The next frame supersedes this one anyway, so never wait for the firmware
+    kb_queue.nowait = true;
+
+    switch (kb_effect.effect)
+    {
+        case EFFECT_BREATHING:
+            // Triangle wave from off up to the configured brightness and back
+            phase = tick % (2 * EFFECT_BREATHING_STEPS);
+            if (phase > EFFECT_BREATHING_STEPS)
+            {
+                phase = 2 * EFFECT_BREATHING_STEPS - phase;
+            }
+
+            brightness = keyboard.brightness * phase / EFFECT_BREATHING_STEPS;
+            kb_firmware_brightness(brightness);
+            break;
+
+        case EFFECT_CYCLE:
+            colour = kbd_colours[tick % ARRAY_SIZE(kbd_colours)].hexvalue;
+
+            set_colour(REGION_LEFT,     colour);
+            set_colour(REGION_CENTRE,   colour);
+            set_colour(REGION_RIGHT,    colour);
+
+            if (keyboard.has_extra == 1)
+            {
+                set_colour(REGION_EXTRA, colour);
+            }
+            break;
+
+        case EFFECT_WAVE:
+            // Each colour travels left -> centre -> right, one region per frame
+            colour = kbd_colours[(tick / 3) % ARRAY_SIZE(kbd_colours)].hexvalue;
+
+            set_colour(REGION_LEFT + (tick % 3) * (REGION_CENTRE - REGION_LEFT), colour);
+            break;
+
+        default:
+            break;
+    }
+
+    // Never queue commands faster than the EC can absorb them
+    delay = EFFECT_INTERVAL_MAX_MS / kb_effect.speed;
+    delay = max_t(unsigned int, delay, (kb_shadow.misses - misses) * EC_COMMAND_INTERVAL_MS);
+
+    schedule_delayed_work(&kb_effect_work, msecs_to_jiffies(delay));
+
+    kb_queue.nowait = false;
+    mutex_unlock(&kb_lock);
+}
+
+// The effect is paused while streamers own the lighting, so the two never take turns
+static int kb_stream_open(struct inode *inode, struct file *file)
+{
+    atomic_inc(&kb_stream.users);
+
+    mutex_lock(&kb_lock);
+    kb_effect_update();
+    mutex_unlock(&kb_lock);
+
+    return nonseekable_open(inode, file);
+}
+
+// Once the last streamer is gone the static lighting or the paused effect is shown again
+static int kb_stream_release(struct inode *inode, struct file *file)
+{
+    if (!atomic_dec_and_test(&kb_stream.users))
+    {
+        return 0;
+    }
+
+    cancel_delayed_work_sync(&kb_stream_work);
+
+    spin_lock(&kb_stream.lock);
+    kb_stream.pending_valid = false;
+    spin_unlock(&kb_stream.lock);
+
+    // Nothing is sent once the device is gone, so no dispatcher gets queued again
+    mutex_lock(&kb_lock);
+    if (!kb_removed)
+    {
+        kb_paint_regions();
+        kb_firmware_brightness(keyboard.brightness);
+        kb_effect_update();
+    }
+    mutex_unlock(&kb_lock);
+
+    return 0;
+}
+
+// Accepts one or more struct kb_frame, only the last one of a write can still be shown
+static ssize_t kb_stream_write(struct file *file, const char __user *buffer, size_t count, loff_t *ppos)
+{
+    size_t frames = count / sizeof(struct kb_frame);
+    struct kb_frame frame;
+    unsigned long delay;
+    bool replaced;
+
+    if (frames == 0 || count % sizeof(struct kb_frame))
+    {
+        return -EINVAL;
+    }
+
+    // The file may outlive the device
+    if (READ_ONCE(kb_removed))
+    {
+        return -ENODEV;
+    }
+
+    if (copy_from_user(&frame, buffer + count - sizeof(frame), sizeof(frame)))
+    {
+        return -EFAULT;
+    }
+
+    if (frame.colour_left > COLOUR_MAX || frame.colour_centre > COLOUR_MAX ||
+        frame.colour_right > COLOUR_MAX || frame.colour_extra > COLOUR_MAX ||
+        frame.brightness > kb_caps.brightness_max)
+    {
+        return -EINVAL;
+    }
+
+    spin_lock(&kb_stream.lock);
+
+    replaced = kb_stream.pending_valid;
+    kb_stream.pending = frame;
+    kb_stream.pending_valid = true;
+
+    kb_stream.accepted += frames;
+    kb_stream.dropped += frames - 1 + (replaced ? 1 : 0);
+
+    delay = time_after(kb_stream.next, jiffies) ? kb_stream.next - jiffies : 0;
+
+    spin_unlock(&kb_stream.lock);
+
+    // Does nothing while the flusher is already waiting for the EC
+    schedule_delayed_work(&kb_stream_work, delay);
+
+    return count;
+}
+
+// Applies the newest frame and holds off the next one until the EC can take it
+static void kb_stream_work_fn(struct work_struct *work)
+{
+    struct kb_frame frame;
+    u64 misses;
+
+    spin_lock(&kb_stream.lock);
+
+    if (!kb_stream.pending_valid)
+    {
+        spin_unlock(&kb_stream.lock);
+        return;
+    }
+
+    frame = kb_stream.pending;
+    kb_stream.pending_valid = false;
+
+    spin_unlock(&kb_stream.lock);
+
+    mutex_lock(&kb_lock);
+
+    misses = kb_shadow.misses;
+    kb_queue.nowait = true;
+
+    if (keyboard.state)
+    {
+        set_colour(REGION_LEFT,     frame.colour_left);
+        set_colour(REGION_CENTRE,   frame.colour_centre);
+        set_colour(REGION_RIGHT,    frame.colour_right);
+
+        if (keyboard.has_extra == 1)
+        {
+            set_colour(REGION_EXTRA, frame.colour_extra);
+        }
+
+        kb_firmware_brightness(frame.brightness);
+    }
+
+    misses = kb_shadow.misses - misses;
+    kb_queue.nowait = false;
+
+    mutex_unlock(&kb_lock);
+
+    spin_lock(&kb_stream.lock);
+    kb_stream.applied++;
+    kb_stream.next = jiffies + msecs_to_jiffies(misses * EC_COMMAND_INTERVAL_MS);
+    spin_unlock(&kb_stream.lock);
+}
+
+static int entroware_evaluate_method(u32 method_id, u32 arg, u32 *retval)
+{
+    struct acpi_buffer in  = { (acpi_size) sizeof(arg), &arg };
+    struct acpi_buffer out = { ACPI_ALLOCATE_BUFFER, NULL };
+    union acpi_object *obj;
+    acpi_status status;
+    ktime_t start;
+    u64 duration;
+    u32 tmp = 0;
+
+    ENTROWARE_DEBUG("evaluate method: %0#4x  IN : %0#6x\n", method_id, arg);
+
+    kb_shadow.firmware_calls++;
+
+    start = ktime_get();
+    status = wmi_evaluate_method(CLEVO_GET_GUID, 0x00, method_id, &in, &out);
+    duration = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+    kb_wmi_hist_record(method_id, status, duration);
+
+    if (unlikely(ACPI_FAILURE(status)))
+    {
+        ENTROWARE_ERROR("evaluate method error");
+        goto exit;
+    }
+
+    obj = (union acpi_object *) out.pointer;
+    if (obj && obj->type == ACPI_TYPE_INTEGER)
+    {
+        tmp = (u32) obj->integer.value;
+    }
+
+    ENTROWARE_DEBUG("%0#4x  OUT: %0#6x (IN: %0#6x)\n", method_id, tmp, arg);
+
+    if (likely(retval))
+    {
+        *retval = tmp;
+    }
+
+    kfree(obj);
+
+exit:
+    trace_entroware_kb_wmi_call(method_id, arg, tmp, status, duration);
+
+    if (unlikely(ACPI_FAILURE(status)))
+    {
+        return -EIO;
+    }
+
+    return 0;
+}
+
+// Adds a call to the histogram of its method, unknown methods count as "other"
+static void kb_wmi_hist_record(u32 method_id, u32 status, u64 duration_ns)
+{
+    struct kb_wmi_hist *hist = &kb_wmi_hists[ARRAY_SIZE(kb_wmi_hists) - 1];
+    unsigned long flags;
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(kb_wmi_hists) - 1; i++)
+    {
+        if (kb_wmi_hists[i].method_id == method_id)
+        {
+            hist = &kb_wmi_hists[i];
+            break;
+        }
+    }
+
+    i = min_t(unsigned int, fls64(div_u64(duration_ns, NSEC_PER_USEC)), WMI_HIST_BUCKETS - 1);
+
+    // The notify handler may run in atomic context
+    spin_lock_irqsave(&kb_wmi_hist_lock, flags);
+
+    hist->calls++;
+    hist->errors += ACPI_FAILURE(status) ? 1 : 0;
+    hist->total_ns += duration_ns;
+    hist->max_ns = max(hist->max_ns, duration_ns);
+    hist->buckets[i]++;
+
+    spin_unlock_irqrestore(&kb_wmi_hist_lock, flags);
+}
+
+// One line per method: totals followed by the bucket counts, bucket bounds in the header
+static int kb_wmi_latency_show(struct seq_file *m, void *unused)
+{
+    struct kb_wmi_hist hist;
+    unsigned int i, j;
+
+    seq_printf(m, "%-12s %10s %8s %10s %10s", "method", "calls", "errors", "avg_us", "max_us");
+    for (j = 0; j < WMI_HIST_BUCKETS - 1; j++)
+    {
+        seq_printf(m, " <%uus", 1U << j);
+    }
+    seq_printf(m, " >=%uus\n", 1U << (WMI_HIST_BUCKETS - 2));
+
+    for (i = 0; i < ARRAY_SIZE(kb_wmi_hists); i++)
+    {
+        spin_lock_irq(&kb_wmi_hist_lock);
+        hist = kb_wmi_hists[i];
+        spin_unlock_irq(&kb_wmi_hist_lock);
+
+        seq_printf(m, "%-12s %10llu %8llu %10llu %10llu", hist.name, hist.calls, hist.errors,
+                   hist.calls ? div64_u64(hist.total_ns, hist.calls) / NSEC_PER_USEC : 0,
+                   div_u64(hist.max_ns, NSEC_PER_USEC));
+
+        for (j = 0; j < WMI_HIST_BUCKETS; j++)
+        {
+            seq_printf(m, " %llu", hist.buckets[j]);
+        }
+        seq_putc(m, '\n');
+    }
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(kb_wmi_latency);
+
+static int set_colour(u32 region, u32 colour)
+{
+    u32 cset = ((colour & 0x0000FF) << 16) | ((colour & 0xFF0000) >> 8) | ((colour & 0x00FF00) >> 8);
+    u32 cmd = region | cset;
+
+    ENTROWARE_DEBUG("Set Colour '%08x' for region '%08x'", colour, region);
+
+    return kb_firmware_set(REGION_SLOT(region), colour, cmd);
+}
 
-        case WMI_CODE_INCREASE_BACKLIGHT:
-            if(keyboard.brightness == BRIGHTNESS_MAX || (keyboard.brightness + 25) > BRIGHTNESS_MAX)
-            {
-                set_brightness(BRIGHTNESS_MAX);
-            }
-            else
-            {
-                set_brightness(keyboard.brightness + STEP_BRIGHTNESS_STEP);
-            }
+static int set_colour_region(const char *buffer, size_t size, u32 region)
+{
+    struct kb_state old;
+    u32 val;
+    int ret = kstrtouint(buffer, 0, &val);
 
-            break;
-            
-        case WMI_CODE_NEXT_COLOUR:
-            if ((keyboard.kbd_colour + 1) > (ARRAY_SIZE(kbd_colours) - 1))
-            {
-                set_kbd_colour(keyboard.kbd_colour = 0);
-            }
-            else
-            {
-                set_kbd_colour(keyboard.kbd_colour + 1);
-            }
+    if (ret)
+    {
+        return ret;
+    }
 
-//            set_kbd_colour((keyboard.kbd_colour + 1) > (ARRAY_SIZE(kbd_colours) - 1) ? 0 : (keyboard.kbd_colour + 1));
+    mutex_lock(&kb_lock);
 
-//            ENTROWARE_INFO("    ARRAY_SIZE %ld", ARRAY_SIZE(kbd_colours) - 1);
-//            ENTROWARE_INFO("    KBKBD_COLOURValue %d", keyboard.kbd_colour + 1);
-            break;
+    old = keyboard;
 
-        case WMI_CODE_TOGGLE_STATE:
-            set_kb_state(keyboard.state == 0 ? 1 : 0);
-            break;
+    if(!set_colour(region, val))
+    {
+        write_seqlock(&kb_seqlock);
+        *kb_region_colour(region) = val;
+        write_sequnlock(&kb_seqlock);
+
+        entroware_leds_sync_colours();
+        kb_notify_changes(&old);
+    }
+
+    mutex_unlock(&kb_lock);
+
+    return ret ? : size;
+}
 
+// Stored colour of a region in the keyboard struct
+static u32 *kb_region_colour(u32 region)
+{
+    switch(region)
+    {
+        case REGION_LEFT:
+            return &keyboard.colour.left;
+        case REGION_CENTRE:
+            return &keyboard.colour.centre;
+        case REGION_RIGHT:
+            return &keyboard.colour.right;
         default:
-            break;
+            return &keyboard.colour.extra;
     }
 }
 
-static void set_kbd_colour(u8 kbd_colour)
+// Consistent copy of the keyboard struct, safe to take without kb_lock
+static void kb_snapshot(struct kb_state *snapshot)
 {
-    ENTROWARE_INFO("colour: %s\n", kbd_colours[kbd_colour].name);
+    unsigned int seq;
 
-    if(!entroware_evaluate_method(SET_KB_LED, kbd_colours[kbd_colour].key, NULL))
+    do
     {
-        set_colour(REGION_LEFT,     kbd_colours[kbd_colour].hexvalue);
-        set_colour(REGION_CENTRE,   kbd_colours[kbd_colour].hexvalue);
-        set_colour(REGION_RIGHT,    kbd_colours[kbd_colour].hexvalue);
+        seq = read_seqbegin(&kb_seqlock);
+        *snapshot = keyboard;
+    } while (read_seqretry(&kb_seqlock, seq));
+}
 
-        // increment kbd_colour int
-        keyboard.kbd_colour = kbd_colour;
+// Wakes pollers of every attribute whose value differs from the old state
+static void kb_notify_changes(const struct kb_state *old)
+{
+    bool changed = false;
+
+    if (old->colour.left != keyboard.colour.left)
+    {
+        kb_sysfs_notify("colour_left");
+        changed = true;
     }
 
-    if(kbd_colour == 0)
+    if (old->colour.centre != keyboard.colour.centre)
     {
-        set_colour(REGION_LEFT,      keyboard.colour.left);
-        set_colour(REGION_CENTRE,    keyboard.colour.centre);
-        set_colour(REGION_RIGHT,     keyboard.colour.right);
+        kb_sysfs_notify("colour_centre");
+        changed = true;
+    }
 
-        if(keyboard.has_extra == 1)
-        {
-            set_colour(REGION_EXTRA, keyboard.colour.extra);
-        }
+    if (old->colour.right != keyboard.colour.right)
+    {
+        kb_sysfs_notify("colour_right");
+        changed = true;
+    }
+
+    if (old->colour.extra != keyboard.colour.extra)
+    {
+        kb_sysfs_notify("colour_extra");
+        changed = true;
+    }
+
+    if (old->brightness != keyboard.brightness)
+    {
+        kb_sysfs_notify("brightness");
+        changed = true;
+    }
+
+    if (old->state != keyboard.state)
+    {
+        kb_sysfs_notify("state");
+        changed = true;
+    }
+
+    if (old->kbd_colour != keyboard.kbd_colour)
+    {
+        kb_sysfs_notify("kbd_colour");
+    }
+
+    if (changed)
+    {
+        kb_sysfs_notify("colours");
     }
 }
 
-static void set_brightness(u8 brightness)
+// Wakes poll() / epoll waiters on a sysfs attribute of the platform device
+static void kb_sysfs_notify(const char *attr)
 {
-    ENTROWARE_INFO("brightness: %d\n", brightness);
-    if (!entroware_evaluate_method(SET_KB_LED, 0xF4000000 | brightness, NULL))
-	{
-		keyboard.brightness = brightness;
-	}
+    if (entroware_platform_device)
+    {
+        sysfs_notify(&entroware_platform_device->dev.kobj, NULL, attr);
+    }
 }
 
-static void set_kb_state(u8 state)
+// Applies all regions, brightness and state. Values the firmware already holds are
+// elided by the shadow, so only the changed settings are sent. If a command fails the
+// settings sent before it stay applied, and only those are published
+static int set_kb_lighting(const struct kb_lighting *lighting)
 {
-    u32 cmd = 0xE0000000;
-    ENTROWARE_INFO("state: %d\n", state);
+    struct kb_state old = keyboard;
+    struct kb_state new = keyboard;
+    int ret;
 
-    if(state == 0)
+    // The custom colours take over from any kbd_colour preset
+    ret = kb_firmware_set(SHADOW_KBD_COLOUR, KB_KBD_COLOUR_DEFAULT, kbd_colours[KB_KBD_COLOUR_DEFAULT].key);
+    if (ret)
     {
-        cmd |= 0x003001;
+        goto publish;
     }
-    else
+    new.kbd_colour = KB_KBD_COLOUR_DEFAULT;
+
+    ret = set_colour(REGION_LEFT, lighting->colour.left);
+    if (ret)
     {
-        cmd |= 0x07F001;
+        goto publish;
     }
+    new.colour.left = lighting->colour.left;
 
-    if (!entroware_evaluate_method(SET_KB_LED, cmd, NULL))
+    ret = set_colour(REGION_CENTRE, lighting->colour.centre);
+    if (ret)
     {
-        keyboard.state = state;
+        goto publish;
+    }
+    new.colour.centre = lighting->colour.centre;
+
+    ret = set_colour(REGION_RIGHT, lighting->colour.right);
+    if (ret)
+    {
+        goto publish;
+    }
+    new.colour.right = lighting->colour.right;
+
+    if (keyboard.has_extra == 1)
+    {
+        ret = set_colour(REGION_EXTRA, lighting->colour.extra);
+        if (ret)
+        {
+            goto publish;
+        }
+        new.colour.extra = lighting->colour.extra;
+    }
+
+    ret = kb_firmware_brightness(lighting->brightness);
+    if (ret)
+    {
+        goto publish;
+    }
+    new.brightness = lighting->brightness;
+
+    ret = kb_firmware_state(lighting->state);
+    if (ret)
+    {
+        goto publish;
     }
+    new.state = lighting->state;
+
+publish:
+    // Publish the whole set at once so readers never see half of a commit
+    write_seqlock(&kb_seqlock);
+    keyboard = new;
+    write_sequnlock(&kb_seqlock);
+
+    entroware_leds_sync_colours();
+    kb_notify_changes(&old);
+    kb_effect_update();
+
+    return ret;
 }
 
-static int entroware_evaluate_method(u32 method_id, u32 arg, u32 *retval)
+// Queues a SET_KB_LED command unless the firmware already holds the same value for the slot
+static int kb_firmware_set(enum kb_shadow_slot slot, u32 value, u32 cmd)
 {
-    struct acpi_buffer in  = { (acpi_size) sizeof(arg), &arg };
-    struct acpi_buffer out = { ACPI_ALLOCATE_BUFFER, NULL };
-    union acpi_object *obj;
-    acpi_status status;
-    u32 tmp;
-
-    ENTROWARE_DEBUG("evaluate method: %0#4x  IN : %0#6x\n", method_id, arg);
+    lockdep_assert_held(&kb_lock);
 
-    status = wmi_evaluate_method(CLEVO_GET_GUID, 0x00, method_id, &in, &out);
+    if (kb_removed)
+    {
+        return -ENODEV;
+    }
 
-    if (unlikely(ACPI_FAILURE(status)))
+    if (test_bit(slot, &kb_shadow.valid) && kb_shadow.value[slot] == value)
     {
-        ENTROWARE_ERROR("evaluate method error");
-        goto exit;
+        kb_shadow.hits++;
+
+        // The value may still be queued by a caller that did not wait, it only counts once the firmware took it
+        return kb_queue.nowait ? 0 : kb_queue_wait(slot);
     }
 
-    obj = (union acpi_object *) out.pointer;
-    if (obj && obj->type == ACPI_TYPE_INTEGER)
+    kb_shadow.misses++;
+
+    kb_shadow.value[slot] = value;
+    set_bit(slot, &kb_shadow.valid);
+
+    return kb_queue_submit(slot, cmd, !kb_queue.nowait);
+}
+
+// Forgets every shadowed value, e.g. when the firmware may have reset the keyboard
+static void kb_shadow_invalidate(void)
+{
+    kb_shadow.valid = 0;
+}
+
+static bool kb_queue_done(enum kb_shadow_slot slot, u64 generation)
+{
+    bool done;
+
+    spin_lock(&kb_queue.lock);
+    done = kb_queue.completed[slot] >= generation;
+    spin_unlock(&kb_queue.lock);
+
+    return done;
+}
+
+// Waits until the command last queued for a slot was sent and returns its result
+static int kb_queue_wait(enum kb_shadow_slot slot)
+{
+    u64 generation;
+
+    spin_lock(&kb_queue.lock);
+    generation = kb_queue.submitted[slot];
+    spin_unlock(&kb_queue.lock);
+
+    wait_event(kb_queue.wait, kb_queue_done(slot, generation));
+
+    return kb_queue.result[slot];
+}
+
+// Puts a command into its slot, replacing a command still waiting there. With wait the
+// result of the firmware call is returned, otherwise the command is sent in the background
+static int kb_queue_submit(enum kb_shadow_slot slot, u32 cmd, bool wait)
+{
+    unsigned long delay;
+    u64 generation;
+
+    spin_lock(&kb_queue.lock);
+
+    if (test_and_set_bit(slot, &kb_queue.pending))
     {
-        tmp = (u32) obj->integer.value;
+        kb_queue.superseded++;
     }
     else
     {
-        tmp = 0;
+        kb_queue.queued_at[slot] = ktime_get();
+        kb_queue.depth++;
+        kb_queue.max_depth = max(kb_queue.max_depth, kb_queue.depth);
     }
 
-    ENTROWARE_DEBUG("%0#4x  OUT: %0#6x (IN: %0#6x)\n", method_id, tmp, arg);
+    kb_queue.cmd[slot] = cmd;
+    generation = ++kb_queue.submitted[slot];
+    kb_queue.queued++;
 
-    if (likely(retval))
+    delay = time_after(kb_queue.next, jiffies) ? kb_queue.next - jiffies : 0;
+
+    spin_unlock(&kb_queue.lock);
+
+    // Does nothing while the dispatcher is already waiting for the rate limit
+    schedule_delayed_work(&kb_queue_work, delay);
+
+    if (!wait)
     {
-        *retval = tmp;
+        return 0;
     }
 
-    kfree(obj);
+    // Every submitter holds kb_lock, so nothing can replace the command while we wait
+    wait_event(kb_queue.wait, kb_queue_done(slot, generation));
 
-exit:
-    if (unlikely(ACPI_FAILURE(status)))
+    return kb_queue.result[slot];
+}
+
+// Sends the queued commands one at a time, never faster than command_interval_ms
+static void kb_queue_work_fn(struct work_struct *work)
+{
+    enum kb_shadow_slot slot;
+    u64 generation, latency;
+    ktime_t queued_at;
+    u32 cmd;
+    int ret;
+
+    for (;;)
     {
-        return -EIO;
+        spin_lock(&kb_queue.lock);
+
+        if (!kb_queue.pending)
+        {
+            spin_unlock(&kb_queue.lock);
+            return;
+        }
+
+        if (!kb_queue.draining && time_before(jiffies, kb_queue.next))
+        {
+            schedule_delayed_work(&kb_queue_work, kb_queue.next - jiffies);
+            spin_unlock(&kb_queue.lock);
+            return;
+        }
+
+        slot = __ffs(kb_queue.pending);
+        clear_bit(slot, &kb_queue.pending);
+        kb_queue.depth--;
+
+        cmd = kb_queue.cmd[slot];
+        queued_at = kb_queue.queued_at[slot];
+        generation = kb_queue.submitted[slot];
+
+        spin_unlock(&kb_queue.lock);
+
+        ret = entroware_evaluate_method(SET_KB_LED, cmd, NULL);
+        if (ret)
+        {
+            // The firmware state is unknown after a failed call
+            clear_bit(slot, &kb_shadow.valid);
+        }
+
+        latency = ktime_to_ns(ktime_sub(ktime_get(), queued_at));
+
+        spin_lock(&kb_queue.lock);
+
+        kb_queue.result[slot] = ret;
+        kb_queue.completed[slot] = generation;
+        kb_queue.next = jiffies + msecs_to_jiffies(param_command_interval_ms);
+
+        kb_queue.dispatched++;
+        kb_queue.errors += ret ? 1 : 0;
+        kb_queue.last_latency_ns = latency;
+        kb_queue.max_latency_ns = max(kb_queue.max_latency_ns, latency);
+
+        spin_unlock(&kb_queue.lock);
+
+        wake_up_all(&kb_queue.wait);
+    }
+}
+
+#if IS_REACHABLE(CONFIG_LEDS_CLASS_MULTICOLOR)
+static int kb_led_brightness_set(struct led_classdev *cdev, enum led_brightness value)
+{
+    struct kb_region_led *led = container_of(lcdev_to_mccdev(cdev), struct kb_region_led, mc);
+    u32 colour = (led->subleds[0].intensity << 16) | (led->subleds[1].intensity << 8) | led->subleds[2].intensity;
+    struct kb_state old;
+    int ret;
+
+    mutex_lock(&kb_lock);
+
+    old = keyboard;
+
+    ret = set_colour(led->region, colour);
+    if (ret)
+    {
+        mutex_unlock(&kb_lock);
+        return ret;
+    }
+
+    write_seqlock(&kb_seqlock);
+    *kb_region_colour(led->region) = colour;
+    write_sequnlock(&kb_seqlock);
+
+    kb_notify_changes(&old);
+
+    // All regions share the keyboard brightness, LED_OFF switches the keyboard off
+    if (value == LED_OFF)
+    {
+        set_kb_state(0);
+    }
+    else
+    {
+        set_brightness(value);
+        set_kb_state(1);
     }
 
+    mutex_unlock(&kb_lock);
+
     return 0;
 }
 
-static int set_colour(u32 region, u32 colour)
+static enum led_brightness kb_led_brightness_get(struct led_classdev *cdev)
 {
-    u32 cset = ((colour & 0x0000FF) << 16) | ((colour & 0xFF0000) >> 8) | ((colour & 0x00FF00) >> 8);
-    u32 cmd = region | cset;
+    struct kb_state kb;
 
-    ENTROWARE_DEBUG("Set Colour '%08x' for region '%08x'", colour, region);
+    kb_snapshot(&kb);
 
-    return entroware_evaluate_method(SET_KB_LED, cmd, NULL);
+    return kb.state ? kb.brightness : LED_OFF;
 }
 
-static int set_colour_region(const char *buffer, size_t size, u32 region)
+static void entroware_leds_init(void)
 {
-    u32 val;
-    int ret = kstrtouint(buffer, 0, &val);
+    struct kb_region_led *led;
+    int i, err;
 
-    if (ret)
+    for (i = 0; i < ARRAY_SIZE(kb_region_leds); i++)
     {
-        return ret;
+        led = &kb_region_leds[i];
+
+        if (led->region == REGION_EXTRA && keyboard.has_extra != 1)
+        {
+            continue;
+        }
+
+        led->subleds[0].color_index = LED_COLOR_ID_RED;
+        led->subleds[1].color_index = LED_COLOR_ID_GREEN;
+        led->subleds[2].color_index = LED_COLOR_ID_BLUE;
+
+        led->mc.subled_info = led->subleds;
+        led->mc.num_colors = ARRAY_SIZE(led->subleds);
+
+        led->mc.led_cdev.name = led->name;
+        led->mc.led_cdev.max_brightness = kb_caps.brightness_max;
+        led->mc.led_cdev.flags = LED_BRIGHT_HW_CHANGED | LED_RETAIN_BRIGHTNESS;
+        led->mc.led_cdev.brightness_set_blocking = kb_led_brightness_set;
+        led->mc.led_cdev.brightness_get = kb_led_brightness_get;
+
+        err = led_classdev_multicolor_register(&entroware_platform_device->dev, &led->mc);
+        if (err)
+        {
+            ENTROWARE_ERROR("Could not register LED %s (%d)\n", led->name, err);
+            continue;
+        }
+
+        led->registered = true;
     }
+}
 
-    if(!set_colour(region, val))
+static void entroware_leds_exit(void)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(kb_region_leds); i++)
     {
-        switch(region)
+        if (kb_region_leds[i].registered)
         {
-            case REGION_LEFT:
-                keyboard.colour.left = val;
-                break;
-            case REGION_CENTRE:
-                keyboard.colour.centre = val;
-                break;
-            case REGION_RIGHT:
-                keyboard.colour.right = val;
-                break;
-            case REGION_EXTRA:
-                keyboard.colour.extra = val;
-                break;
+            led_classdev_multicolor_unregister(&kb_region_leds[i].mc);
+            kb_region_leds[i].registered = false;
         }
     }
+}
 
-    return ret ? : size;
+// Mirrors the region colours into the LED intensities
+static void entroware_leds_sync_colours(void)
+{
+    struct kb_region_led *led;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(kb_region_leds); i++)
+    {
+        led = &kb_region_leds[i];
+
+        led->subleds[0].intensity = (*led->colour >> 16) & 0xFF;
+        led->subleds[1].intensity = (*led->colour >> 8) & 0xFF;
+        led->subleds[2].intensity = *led->colour & 0xFF;
+    }
+}
+
+// Raises brightness_hw_changed on every region after the firmware hotkeys changed brightness or state
+static void entroware_leds_notify_brightness(void)
+{
+    enum led_brightness value = keyboard.state ? keyboard.brightness : LED_OFF;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(kb_region_leds); i++)
+    {
+        if (kb_region_leds[i].registered)
+        {
+            led_classdev_notify_brightness_hw_changed(&kb_region_leds[i].mc.led_cdev, value);
+        }
+    }
+}
+#else
+static void entroware_leds_init(void) { }
+static void entroware_leds_exit(void) { }
+static void entroware_leds_sync_colours(void) { }
+static void entroware_leds_notify_brightness(void) { }
+#endif
+
+static void entroware_debugfs_init(void)
+{
+    entroware_debugfs_dir = debugfs_create_dir(DRIVER_NAME, NULL);
+
+    debugfs_create_u64("shadow_hits", 0444, entroware_debugfs_dir, &kb_shadow.hits);
+    debugfs_create_u64("shadow_misses", 0444, entroware_debugfs_dir, &kb_shadow.misses);
+    debugfs_create_u64("firmware_calls", 0444, entroware_debugfs_dir, &kb_shadow.firmware_calls);
+    debugfs_create_file("wmi_latency", 0444, entroware_debugfs_dir, NULL, &kb_wmi_latency_fops);
+
+    debugfs_create_u64("hotkey_events", 0444, entroware_debugfs_dir, &kb_hotkey_stats.events);
+    debugfs_create_u64("hotkey_dropped", 0444, entroware_debugfs_dir, &kb_hotkey_stats.dropped);
+    debugfs_create_u64("hotkey_coalesced", 0444, entroware_debugfs_dir, &kb_hotkey_stats.coalesced);
+    debugfs_create_u64("hotkey_last_latency_ns", 0444, entroware_debugfs_dir, &kb_hotkey_stats.last_latency_ns);
+    debugfs_create_u64("hotkey_max_latency_ns", 0444, entroware_debugfs_dir, &kb_hotkey_stats.max_latency_ns);
+
+    debugfs_create_u64("resume_latency_ns", 0444, entroware_debugfs_dir, &kb_resume_stats.last_latency_ns);
+    debugfs_create_u64("resume_replay_ns", 0444, entroware_debugfs_dir, &kb_resume_stats.last_replay_ns);
+
+    debugfs_create_u64("stream_accepted", 0444, entroware_debugfs_dir, &kb_stream.accepted);
+    debugfs_create_u64("stream_applied", 0444, entroware_debugfs_dir, &kb_stream.applied);
+    debugfs_create_u64("stream_dropped", 0444, entroware_debugfs_dir, &kb_stream.dropped);
+
+    debugfs_create_u64("queue_depth", 0444, entroware_debugfs_dir, &kb_queue.depth);
+    debugfs_create_u64("queue_max_depth", 0444, entroware_debugfs_dir, &kb_queue.max_depth);
+    debugfs_create_u64("queue_queued", 0444, entroware_debugfs_dir, &kb_queue.queued);
+    debugfs_create_u64("queue_superseded", 0444, entroware_debugfs_dir, &kb_queue.superseded);
+    debugfs_create_u64("queue_dispatched", 0444, entroware_debugfs_dir, &kb_queue.dispatched);
+    debugfs_create_u64("queue_errors", 0444, entroware_debugfs_dir, &kb_queue.errors);
+    debugfs_create_u64("queue_latency_ns", 0444, entroware_debugfs_dir, &kb_queue.last_latency_ns);
+    debugfs_create_u64("queue_max_latency_ns", 0444, entroware_debugfs_dir, &kb_queue.max_latency_ns);
+
+    debugfs_create_u64("init_ns", 0444, entroware_debugfs_dir, &kb_init_stats.init_ns);
+    debugfs_create_u64("probe_ns", 0444, entroware_debugfs_dir, &kb_init_stats.probe_ns);
+    debugfs_create_u64("init_lighting_ns", 0444, entroware_debugfs_dir, &kb_init_stats.lighting_ns);
+    debugfs_create_u64("init_ready_ns", 0444, entroware_debugfs_dir, &kb_init_stats.ready_ns);
 }
 
 static int kbd_colour_validator(const char *val, const struct kernel_param *kp)
@@ -594,5 +2200,34 @@ static int brightness_validator(const char *val, const struct kernel_param *kp)
     return param_set_int(val, kp);
 }
 
+static int brightness_step_validator(const char *val, const struct kernel_param *kp)
+{
+    unsigned int step = 0;
+    int ret;
+
+    ret = kstrtouint(val, 10, &step);
+    if (ret != 0 || step < 1 || step > BRIGHTNESS_MAX)
+    {
+        return -EINVAL;
+    }
+
+    return param_set_uint(val, kp);
+}
+
+// Left, centre and right always exist, only the extra region can be chosen
+static int regions_validator(const char *val, const struct kernel_param *kp)
+{
+    unsigned int regions = 0;
+    int ret;
+
+    ret = kstrtouint(val, 10, &regions);
+    if (ret != 0 || (regions != 0 && regions != KB_REGIONS_3 && regions != KB_REGIONS_4))
+    {
+        return -EINVAL;
+    }
+
+    return param_set_uint(val, kp);
+}
+
 module_init(entroware_kb_init);
 module_exit(entroware_kb_exit);
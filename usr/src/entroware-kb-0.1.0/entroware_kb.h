@@ -26,6 +26,23 @@
 #define pr_fmt(fmt) DRIVER_NAME ": " fmt
 
 #include <linux/list.h>
+#include <linux/debugfs.h>
+#include <linux/dmi.h>
+#include <linux/input.h>
+#include <linux/input/sparse-keymap.h>
+#include <linux/kfifo.h>
+#include <linux/leds.h>
+#include <linux/miscdevice.h>
+#include <linux/mutex.h>
+#include <linux/seqlock.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+
+#if IS_REACHABLE(CONFIG_LEDS_CLASS_MULTICOLOR)
+#include <linux/led-class-multicolor.h>
+#endif
 #include <linux/platform_device.h>
 #include <linux/module.h>
 
@@ -49,6 +66,9 @@
 #define REGION_RIGHT                    0xF2000000
 #define REGION_EXTRA                    0xF3000000
 
+// Shadow slot for a region (REGION_LEFT .. REGION_EXTRA map to SHADOW_LEFT .. SHADOW_EXTRA)
+#define REGION_SLOT(region)             (((region) >> 24) & 0x0F)
+
 #define KEYBOARD_BRIGHTNESS             0xF4000000
 
 #define COLOUR_WHITE                     0xFFFFFF
@@ -73,7 +93,35 @@
 #define WMI_CODE_NEXT_COLOUR            0x83
 #define WMI_CODE_TOGGLE_STATE           0x9F
 
+// Keys reported through the input device for the WMI codes. The driver acts on the WMI
+// codes themselves, independent of what the keymap reports
+static const struct key_entry entroware_keymap[] = {
+    { KE_KEY, WMI_CODE_DECREASE_BACKLIGHT,  { KEY_KBDILLUMDOWN } },
+    { KE_KEY, WMI_CODE_INCREASE_BACKLIGHT,  { KEY_KBDILLUMUP } },
+    { KE_IGNORE, WMI_CODE_NEXT_COLOUR,      { KEY_RESERVED } },         // No keycode for cycling colours, handled by the driver
+    { KE_KEY, WMI_CODE_TOGGLE_STATE,        { KEY_KBDILLUMTOGGLE } },
+    { KE_END, 0 }
+};
+
 #define STEP_BRIGHTNESS_STEP            85
+#define BRIGHTNESS_RAMP_MS_MAX          5000
+
+#define EC_COMMAND_INTERVAL_MS          20  // Minimum time the EC needs per SET_KB_LED command
+
+#define HOTKEY_FIFO_SIZE                16  // Must be a power of 2
+
+#define EFFECT_SPEED_MIN                1
+#define EFFECT_SPEED_MAX                10
+#define EFFECT_SPEED_DEFAULT            5
+#define EFFECT_INTERVAL_MAX_MS          500 // Frame interval at the slowest speed
+#define EFFECT_BREATHING_STEPS          16
+
+#define COLOUR_MAX                      0xFFFFFF
+
+#define KB_PALETTE_MAX                  16
+#define KB_PROFILE_NAME_LEN             16
+
+#define WMI_HIST_BUCKETS                20  // Bucket n counts calls of [2^(n-1), 2^n) us, the last one everything above
 
 // Module Parameter Values
 //static bool 
@@ -112,23 +160,103 @@ static ssize_t set_kbd_colour_fs(struct device *child, struct device_attribute *
 // Sysfs Interface for if the keyboard has extra region
 static ssize_t show_hasextra_fs(struct device *child, struct device_attribute *attr, char *buffer);
 
+// Sysfs Interface for the lighting effect
+static ssize_t show_effect_fs(struct device *child, struct device_attribute *attr, char *buffer);
+static ssize_t set_effect_fs(struct device *child, struct device_attribute *attr, const char *buffer, size_t size);
+
+// Sysfs Interface for the lighting effect speed
+static ssize_t show_effect_speed_fs(struct device *child, struct device_attribute *attr, char *buffer);
+static ssize_t set_effect_speed_fs(struct device *child, struct device_attribute *attr, const char *buffer, size_t size);
+
+// Sysfs Interface for the detected keyboard capabilities
+static ssize_t show_capabilities_fs(struct device *child, struct device_attribute *attr, char *buffer);
+
+// Sysfs Interface for a binary snapshot of the whole keyboard state
+static ssize_t show_snapshot_fs(struct file *file, struct kobject *kobj, struct bin_attribute *attr, char *buffer, loff_t off, size_t count);
+
+// Sysfs Interface for all regions, brightness and state in a single write, optionally without waiting for the firmware
+static ssize_t show_colours_fs(struct device *child, struct device_attribute *attr, char *buffer);
+static ssize_t set_colours_fs(struct device *child, struct device_attribute *attr, const char *buffer, size_t size);
+
+// Sysfs Interface for the profile palette, one "name left centre right extra brightness" line per profile
+static ssize_t show_palette_fs(struct device *child, struct device_attribute *attr, char *buffer);
+static ssize_t set_palette_fs(struct device *child, struct device_attribute *attr, const char *buffer, size_t size);
+
+// Sysfs Interface for the active profile (name of the profile)
+static ssize_t show_profile_fs(struct device *child, struct device_attribute *attr, char *buffer);
+static ssize_t set_profile_fs(struct device *child, struct device_attribute *attr, const char *buffer, size_t size);
+
+// Region colours
+struct kb_colours
+{
+    u32 left;
+    u32 centre;
+    u32 right;
+    u32 extra;
+};
+
+// Lighting settings committed to the keyboard as one batch
+struct kb_lighting
+{
+    struct kb_colours colour;
+
+    u8 brightness;
+    u8 state;
+};
+
+// Named lighting profile, the state is taken from the keyboard when it is applied
+struct kb_profile
+{
+    char name[KB_PROFILE_NAME_LEN];
+    struct kb_lighting lighting;
+};
+
 // Keyboard struct
-static struct
+struct kb_state
 {
     u8 has_extra;
     u8 state;
 
-    struct 
-    {
-        u32 left;
-        u32 centre;
-        u32 right;
-        u32 extra;
-    } colour;
+    struct kb_colours colour;
+
+    u8 brightness;
+    u8 kbd_colour;
+};
+
+// Layout of the snapshot attribute, native endian. New fields are only ever appended,
+// together with a version bump
+#define KB_SNAPSHOT_VERSION             1
+
+#define KB_CAP_EXTRA                    0x01    // Keyboard has the extra region
+#define KB_CAP_LEDS                     0x02    // Regions are exported as multicolor LEDs
 
+struct kb_snapshot_data
+{
+    u8 version;
+    u8 caps;
+    u8 state;
     u8 brightness;
     u8 kbd_colour;
-} keyboard = {
+    u8 reserved[3];
+
+    u32 colour_left;
+    u32 colour_centre;
+    u32 colour_right;
+    u32 colour_extra;
+} __packed;
+
+// Lighting frame written to the /dev/entroware_kb stream device, native endian
+struct kb_frame
+{
+    u32 colour_left;
+    u32 colour_centre;
+    u32 colour_right;
+    u32 colour_extra;
+    u8 brightness;
+    u8 reserved[3];
+} __packed;
+
+static struct kb_state keyboard = {
     .has_extra = 0,
     .kbd_colour = DEFAULT_KBD_COLOUR,
     .state = 1,
@@ -141,6 +269,248 @@ static struct
     }
 };
 
+// Concurrency model:
+// kb_lock serializes every writer (sysfs, hotkeys, effects, LEDs) around the firmware call,
+// the shadow update and the keyboard update. Updates of the keyboard struct are additionally
+// published through kb_seqlock, so readers take a consistent snapshot without sleeping.
+static DEFINE_MUTEX(kb_lock);
+static DEFINE_SEQLOCK(kb_seqlock);
+
+// Set under kb_lock once the device is being removed, no command reaches the firmware afterwards
+static bool kb_removed;
+
+// Shadow slots for every setting sent to the firmware
+enum kb_shadow_slot
+{
+    SHADOW_LEFT,
+    SHADOW_CENTRE,
+    SHADOW_RIGHT,
+    SHADOW_EXTRA,
+    SHADOW_BRIGHTNESS,
+    SHADOW_STATE,
+    SHADOW_KBD_COLOUR,
+    SHADOW_COUNT
+};
+
+// Last values handed to the firmware. A failed command clears the valid bit again
+static struct
+{
+    u32 value[SHADOW_COUNT];
+    unsigned long valid;
+
+    u64 hits;
+    u64 misses;
+    u64 firmware_calls;
+} kb_shadow;
+
+// Command queue in front of the firmware, one slot per shadow slot. A newer command for a
+// slot replaces the queued one, and a single dispatcher sends the slots at the configured rate
+static struct
+{
+    spinlock_t lock;
+    wait_queue_head_t wait;
+
+    u32 cmd[SHADOW_COUNT];
+    ktime_t queued_at[SHADOW_COUNT];
+    unsigned long pending;
+    unsigned long next;
+
+    u64 submitted[SHADOW_COUNT];        // Generation of the last command queued per slot
+    u64 completed[SHADOW_COUNT];        // Generation of the last command sent per slot
+    int result[SHADOW_COUNT];
+
+    bool nowait;                        // Protected by kb_lock, set by callers that do not wait for the firmware
+    bool draining;                      // Set on remove, the remaining commands are sent without the rate limit
+
+    u64 depth;
+    u64 max_depth;
+    u64 queued;
+    u64 superseded;
+    u64 dispatched;
+    u64 errors;
+    u64 last_latency_ns;
+    u64 max_latency_ns;
+} kb_queue = {
+    .lock = __SPIN_LOCK_UNLOCKED(kb_queue.lock),
+    .wait = __WAIT_QUEUE_HEAD_INITIALIZER(kb_queue.wait),
+};
+
+// Lighting effects run by the driver
+enum kb_effect
+{
+    EFFECT_STATIC,
+    EFFECT_BREATHING,
+    EFFECT_CYCLE,
+    EFFECT_WAVE,
+    EFFECT_COUNT
+};
+
+static const char * const kb_effect_names[EFFECT_COUNT] = {
+    [EFFECT_STATIC]     = "static",
+    [EFFECT_BREATHING]  = "breathing",
+    [EFFECT_CYCLE]      = "cycle",
+    [EFFECT_WAVE]       = "wave",
+};
+
+static struct
+{
+    u8 effect;
+    u8 speed;
+    bool running;
+    unsigned int tick;
+} kb_effect = {
+    .effect = EFFECT_STATIC,
+    .speed = EFFECT_SPEED_DEFAULT,
+};
+
+// Profiles cycled by the colour hotkey instead of kbd_colours, protected by kb_lock
+static struct
+{
+    struct kb_profile profiles[KB_PALETTE_MAX];
+    unsigned int count;
+    int active;                         // -1 until a profile got applied
+} kb_palette = {
+    .active = -1,
+};
+
+// Capabilities of a keyboard model
+struct kb_capabilities
+{
+    u8 regions;                         // Bitmask of REGION_SLOT() values
+    u8 brightness_max;
+    u8 effects;                         // Bitmask of enum kb_effect
+    const struct key_entry *keymap;
+};
+
+#define KB_REGIONS_3                    (BIT(SHADOW_LEFT) | BIT(SHADOW_CENTRE) | BIT(SHADOW_RIGHT))
+#define KB_REGIONS_4                    (KB_REGIONS_3 | BIT(SHADOW_EXTRA))
+#define KB_EFFECTS_ALL                  (BIT(EFFECT_STATIC) | BIT(EFFECT_BREATHING) | BIT(EFFECT_CYCLE) | BIT(EFFECT_WAVE))
+
+static const struct kb_capabilities kb_caps_three_regions = {
+    .regions = KB_REGIONS_3,
+    .brightness_max = BRIGHTNESS_MAX,
+    .effects = KB_EFFECTS_ALL,
+    .keymap = entroware_keymap,
+};
+
+// Matches a model by vendor, product name and product version as reported by dmidecode.
+// The version tells apart models that share a product name but not the keyboard layout
+#define KB_DMI_MODEL(vendor, name, version, caps)                   \
+    {                                                               \
+        .ident = vendor " " name " " version,                       \
+        .matches = {                                                \
+            DMI_EXACT_MATCH(DMI_SYS_VENDOR, vendor),                \
+            DMI_EXACT_MATCH(DMI_PRODUCT_NAME, name),                \
+            DMI_EXACT_MATCH(DMI_PRODUCT_VERSION, version),          \
+        },                                                          \
+        .driver_data = (void *) &(caps),                            \
+    }
+
+// Known models. Only add a model together with the dmidecode output and the regions and
+// brightness range confirmed on that machine, a wrong entry skips the extra region probe.
+// Machines not listed here start from kb_caps_three_regions and probe the extra region
+static const struct dmi_system_id kb_dmi_table[] = {
+    { }
+};
+
+static struct kb_capabilities kb_caps;
+static const char *kb_caps_source;
+static bool kb_caps_probe_extra;
+
+// Frame stream. Writers replace the pending frame, the flusher takes it out and applies
+// it at the rate the EC sustains, so frames not applied in time are dropped
+static struct
+{
+    spinlock_t lock;
+    struct kb_frame pending;
+    bool pending_valid;
+    unsigned long next;
+    atomic_t users;
+
+    u64 accepted;
+    u64 applied;
+    u64 dropped;
+} kb_stream = {
+    .lock = __SPIN_LOCK_UNLOCKED(kb_stream.lock),
+    .users = ATOMIC_INIT(0),
+};
+
+// Brightness fade, the keyboard struct already holds the target while the firmware follows
+static struct
+{
+    u8 from;
+    u8 to;
+    bool active;
+    ktime_t start;
+} kb_ramp;
+
+// Hotkey event queued by the WMI notify handler
+struct kb_hotkey_event
+{
+    u32 code;
+    ktime_t time;
+};
+
+// Settings the hotkeys act on, folded over a burst of events before being applied
+struct kb_hotkey_target
+{
+    u8 brightness;
+    u8 state;
+    u8 kbd_colour;
+    int profile;
+};
+
+static DEFINE_KFIFO(kb_hotkey_fifo, struct kb_hotkey_event, HOTKEY_FIFO_SIZE);
+static DEFINE_SPINLOCK(kb_hotkey_lock);
+
+static struct
+{
+    u64 events;
+    u64 dropped;
+    u64 coalesced;
+    u64 last_latency_ns;
+    u64 max_latency_ns;
+} kb_hotkey_stats;
+
+// Latency histogram of the WMI methods
+struct kb_wmi_hist
+{
+    u32 method_id;
+    const char *name;
+
+    u64 calls;
+    u64 errors;
+    u64 total_ns;
+    u64 max_ns;
+    u64 buckets[WMI_HIST_BUCKETS];
+};
+
+static struct kb_wmi_hist kb_wmi_hists[] = {
+    { .method_id = GET_EVENT,   .name = "GET_EVENT" },
+    { .method_id = GET_AP,      .name = "GET_AP" },
+    { .method_id = SET_KB_LED,  .name = "SET_KB_LED" },
+    { .method_id = 0,           .name = "other" },    // Must be last
+};
+
+static DEFINE_SPINLOCK(kb_wmi_hist_lock);
+
+// Timing of the driver bring-up, relative to the start of entroware_kb_init()
+static struct
+{
+    ktime_t start;
+    u64 init_ns;
+    u64 probe_ns;
+    u64 lighting_ns;
+    u64 ready_ns;
+} kb_init_stats;
+
+static struct
+{
+    ktime_t resumed;
+    u64 last_latency_ns;
+    u64 last_replay_ns;
+} kb_resume_stats;
+
 static struct
 {
     u8 key;
@@ -159,35 +529,129 @@ static struct
 
 struct platform_device *entroware_platform_device;
 static struct input_dev *entroware_input_device;
+static struct dentry *entroware_debugfs_dir;
 
 // Init and Exit methods
 static int __init entroware_kb_init(void);
 static void __exit entroware_kb_exit(void);
 
-static int __init entroware_input_init(void);
-static void __exit entroware_input_exit(void);
+static int entroware_input_init(void);
+static void entroware_input_exit(void);
 
 // Methods for controlling the Keyboard
 static void set_brightness(u8 brightness);
 static void set_kb_state(u8 state);
 static void set_kbd_colour(u8 kbd_colour);
 static int set_colour(u32 region, u32 colour);
+static int set_kb_lighting(const struct kb_lighting *lighting);
+static void kb_paint_regions(void);
+static void kb_apply_state(void);
+static int kb_profile_apply(int index, u8 brightness, u8 state);
+static int kb_profile_find(const char *name);
+
+static void kb_init_work_fn(struct work_struct *work);
+static DECLARE_WORK(kb_init_work, kb_init_work_fn);
+
+static void kb_resume_work_fn(struct work_struct *work);
+static DECLARE_WORK(kb_resume_work, kb_resume_work_fn);
+
+static int kb_stream_open(struct inode *inode, struct file *file);
+static int kb_stream_release(struct inode *inode, struct file *file);
+static ssize_t kb_stream_write(struct file *file, const char __user *buffer, size_t count, loff_t *ppos);
+static void kb_stream_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(kb_stream_work, kb_stream_work_fn);
+
+static const struct file_operations kb_stream_fops = {
+    .owner      = THIS_MODULE,
+    .open       = kb_stream_open,
+    .release    = kb_stream_release,
+    .write      = kb_stream_write,
+    .llseek     = no_llseek,
+};
+
+static struct miscdevice kb_stream_device = {
+    .minor      = MISC_DYNAMIC_MINOR,
+    .name       = DRIVER_NAME,
+    .fops       = &kb_stream_fops,
+    .mode       = 0600,
+};
+static bool kb_stream_registered;
+
+static void kb_ramp_start(u8 brightness);
+static void kb_ramp_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(kb_ramp_work, kb_ramp_work_fn);
+
+static void kb_effect_update(void);
+static void kb_effect_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(kb_effect_work, kb_effect_work_fn);
 
 static int set_colour_region(const char *buffer, size_t size, u32 region);
+static u32 *kb_region_colour(u32 region);
+static void kb_snapshot(struct kb_state *snapshot);
+static void kb_notify_changes(const struct kb_state *old);
+static void kb_sysfs_notify(const char *attr);
+
+static int kb_firmware_set(enum kb_shadow_slot slot, u32 value, u32 cmd);
+static int kb_firmware_brightness(u8 brightness);
+static int kb_firmware_state(u8 state);
+static void kb_shadow_invalidate(void);
+
+static int kb_queue_wait(enum kb_shadow_slot slot);
+static int kb_queue_submit(enum kb_shadow_slot slot, u32 cmd, bool wait);
+static void kb_queue_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(kb_queue_work, kb_queue_work_fn);
+
+static void entroware_debugfs_init(void);
+static void kb_wmi_hist_record(u32 method_id, u32 status, u64 duration_ns);
+static int kb_wmi_latency_show(struct seq_file *m, void *unused);
 
 static int entroware_wmi_remove(struct platform_device *dev);
 static int entroware_wmi_resume(struct platform_device *dev);
 static int entroware_wmi_probe(struct platform_device *dev);
 static void entroware_wmi_notify(u32 value, void *context);
 
+static void kb_caps_init(void);
+static void kb_hotkey_apply(u32 code, struct kb_hotkey_target *target);
+static void kb_hotkey_work_fn(struct work_struct *work);
+static DECLARE_WORK(kb_hotkey_work, kb_hotkey_work_fn);
+
 static int entroware_evaluate_method(u32 method_id, u32 arg, u32 *retval);
 
+// LED class devices
+static void entroware_leds_init(void);
+static void entroware_leds_exit(void);
+static void entroware_leds_sync_colours(void);
+static void entroware_leds_notify_brightness(void);
+
+#if IS_REACHABLE(CONFIG_LEDS_CLASS_MULTICOLOR)
+// Multicolor LED for a keyboard region, the LED brightness is the global keyboard brightness
+struct kb_region_led
+{
+    u32 region;
+    u32 *colour;
+    const char *name;
+    bool registered;
+
+    struct led_classdev_mc mc;
+    struct mc_subled subleds[3];
+};
+
+static struct kb_region_led kb_region_leds[] = {
+    { .region = REGION_LEFT,    .colour = &keyboard.colour.left,    .name = DRIVER_NAME ":rgb:kbd_backlight_left" },
+    { .region = REGION_CENTRE,  .colour = &keyboard.colour.centre,  .name = DRIVER_NAME ":rgb:kbd_backlight_centre" },
+    { .region = REGION_RIGHT,   .colour = &keyboard.colour.right,   .name = DRIVER_NAME ":rgb:kbd_backlight_right" },
+    { .region = REGION_EXTRA,   .colour = &keyboard.colour.extra,   .name = DRIVER_NAME ":rgb:kbd_backlight_extra" },
+};
+#endif
+
 static struct platform_driver entroware_platform_driver = {
+    .probe = entroware_wmi_probe,
     .remove = entroware_wmi_remove,
     .resume = entroware_wmi_resume,
     .driver = {
         .name  = DRIVER_NAME,
         .owner = THIS_MODULE,
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
     },
 };
 
@@ -204,6 +668,18 @@ static const struct kernel_param_ops param_ops_brightness_ops = {
 	.get	= param_get_int,
 };
 
+static int brightness_step_validator(const char *val, const struct kernel_param *kp);
+static const struct kernel_param_ops param_ops_brightness_step_ops = {
+	.set	= brightness_step_validator,
+	.get	= param_get_uint,
+};
+
+static int regions_validator(const char *val, const struct kernel_param *kp);
+static const struct kernel_param_ops param_ops_regions_ops = {
+	.set	= regions_validator,
+	.get	= param_get_uint,
+};
+
 // Params Variables
 static uint param_colour_left = KB_COLOUR_DEFAULT;
 module_param_named(colour_left, param_colour_left, uint, S_IRUSR);
@@ -229,6 +705,26 @@ static ushort param_brightness = BRIGHTNESS_DEFAULT;
 module_param_cb(brightness, &param_ops_brightness_ops, &param_brightness, S_IRUSR);
 MODULE_PARM_DESC(brightness, "Set the Keyboard Brightness");
 
+static uint param_brightness_step = STEP_BRIGHTNESS_STEP;
+module_param_cb(brightness_step, &param_ops_brightness_step_ops, &param_brightness_step, S_IRUSR | S_IWUSR);
+MODULE_PARM_DESC(brightness_step, "Brightness change per backlight hotkey press");
+
+static uint param_brightness_ramp_ms = 0;
+module_param_named(brightness_ramp_ms, param_brightness_ramp_ms, uint, S_IRUSR | S_IWUSR);
+MODULE_PARM_DESC(brightness_ramp_ms, "Duration of the fade between brightness levels in ms (0 = Instant)");
+
+static uint param_command_interval_ms = 0;
+module_param_named(command_interval_ms, param_command_interval_ms, uint, S_IRUSR | S_IWUSR);
+MODULE_PARM_DESC(command_interval_ms, "Minimum time between two firmware commands in ms (0 = No Limit)");
+
+static uint param_regions = 0;
+module_param_cb(regions, &param_ops_regions_ops, &param_regions, S_IRUSR);
+MODULE_PARM_DESC(regions, "Override the keyboard regions (7 = Left, Centre and Right, 15 = With Extra, 0 = Detect)");
+
+static uint param_brightness_max = 0;
+module_param_named(brightness_max, param_brightness_max, uint, S_IRUSR);
+MODULE_PARM_DESC(brightness_max, "Override the maximum keyboard brightness (0 = Detect)");
+
 static bool param_state = true;
 module_param_named(state, param_state, bool, S_IRUSR);
 MODULE_PARM_DESC(state, "Set the State of the Keyboard TRUE = ON | FALSE = OFF");
@@ -242,5 +738,13 @@ static DEVICE_ATTR(colour_extra,    0644, show_colour_extra_fs,    set_colour_ex
 static DEVICE_ATTR(brightness,      0644, show_brightness_fs,      set_brightness_fs);
 static DEVICE_ATTR(kbd_colour,      0644, show_kbd_colour_fs,      set_kbd_colour_fs);
 static DEVICE_ATTR(extra,           0444, show_hasextra_fs,        NULL);
+static DEVICE_ATTR(capabilities,    0444, show_capabilities_fs,    NULL);
+static DEVICE_ATTR(colours,         0644, show_colours_fs,         set_colours_fs);
+static DEVICE_ATTR(effect,          0644, show_effect_fs,          set_effect_fs);
+static DEVICE_ATTR(effect_speed,    0644, show_effect_speed_fs,    set_effect_speed_fs);
+static DEVICE_ATTR(palette,         0644, show_palette_fs,         set_palette_fs);
+static DEVICE_ATTR(profile,         0644, show_profile_fs,         set_profile_fs);
+
+static BIN_ATTR(snapshot,           0444, show_snapshot_fs,        NULL,   sizeof(struct kb_snapshot_data));
 
 #endif
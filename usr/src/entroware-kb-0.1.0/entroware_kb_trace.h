@@ -0,0 +1,60 @@
+/*
+* entroware_kb_trace.h
+*
+* Copyright (C) 2018 Entroware <dev@entroware.com>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM entroware_kb
+
+#if !defined(_ENTROWARE_KB_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _ENTROWARE_KB_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// One WMI method call, status is the ACPI status of wmi_evaluate_method()
+TRACE_EVENT(entroware_kb_wmi_call,
+
+    TP_PROTO(u32 method_id, u32 arg, u32 retval, u32 status, u64 duration_ns),
+
+    TP_ARGS(method_id, arg, retval, status, duration_ns),
+
+    TP_STRUCT__entry(
+        __field(u32, method_id)
+        __field(u32, arg)
+        __field(u32, retval)
+        __field(u32, status)
+        __field(u64, duration_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->method_id = method_id;
+        __entry->arg = arg;
+        __entry->retval = retval;
+        __entry->status = status;
+        __entry->duration_ns = duration_ns;
+    ),
+
+    TP_printk("method=%#04x arg=%#010x retval=%#010x status=%#x duration_ns=%llu",
+        __entry->method_id, __entry->arg, __entry->retval, __entry->status,
+        (unsigned long long) __entry->duration_ns)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE entroware_kb_trace
+
+#include <trace/define_trace.h>